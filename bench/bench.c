@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "bench.h"
+
+#define BENCH_COUNTERS 3
+#define BENCH_LINE_MAX 4096
+
+/**
+ * State of the benchmark run.
+ */
+static struct bench_info {
+	int counter_fd[BENCH_COUNTERS];
+	unsigned long long begin_ns;
+	unsigned long long elapsed_ns;
+	bool running;
+	bool counters;
+	bool quick;
+	bool verbose;
+	bool failed;
+	unsigned int random;
+	struct bench_sequences recorded;
+} s_info = {
+	.counter_fd = { -1, -1, -1 },
+	.begin_ns = 0,
+	.elapsed_ns = 0,
+	.running = false,
+	.counters = false,
+	.quick = false,
+	.verbose = false,
+	.failed = false,
+	.random = 1,
+	.recorded = { 0, },
+};
+
+/*
+ * @brief Opens one counter of the group, the first one leads the group.
+ */
+static int _bench_counter_open(unsigned long long config, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group_fd < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/*
+ * @brief Opens the instruction, branch miss and cache miss counters.
+ */
+static void _bench_counters_open(void)
+{
+	static const unsigned long long configs[BENCH_COUNTERS] = {
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES,
+		PERF_COUNT_HW_CACHE_MISSES,
+	};
+	int i;
+
+	for (i = 0; i < BENCH_COUNTERS; i++) {
+		s_info.counter_fd[i] = _bench_counter_open(configs[i], i ? s_info.counter_fd[0] : -1);
+		if (s_info.counter_fd[i] < 0) {
+			if (s_info.verbose)
+				perror("perf_event_open");
+			break;
+		}
+	}
+
+	s_info.counters = i == BENCH_COUNTERS;
+}
+
+/*
+ * @brief Finds the winner of a row of a CSV export, the field before the quoted score.
+ * @return KEY_TYPE_ME, KET_TYPE_OPPONENT or -1 if the row has no winner
+ */
+static int _bench_csv_winner(const char *line)
+{
+	const char *me = NULL;
+	const char *op = NULL;
+	const char *p;
+
+	/* Names are quoted and may hold anything, but the score is the last field */
+	for (p = strstr(line, ",me,\""); p; p = strstr(p + 1, ",me,\""))
+		me = p;
+	for (p = strstr(line, ",op,\""); p; p = strstr(p + 1, ",op,\""))
+		op = p;
+
+	if (me == NULL && op == NULL)
+		return -1;
+
+	return me > op ? KEY_TYPE_ME : KET_TYPE_OPPONENT;
+}
+
+/*
+ * @brief Loads the point sequences of the matches in a CSV export of the application.
+ */
+static bool _bench_load_recorded(const char *path)
+{
+	struct bench_sequences *rec = &s_info.recorded;
+	char line[BENCH_LINE_MAX];
+	long last_match = -1;
+	int capacity = 0;
+	int start_capacity = 0;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		long match;
+		int winner = _bench_csv_winner(line);
+
+		if (winner < 0 || sscanf(line, "%ld,", &match) != 1)
+			continue;
+
+		if (rec->total == capacity) {
+			capacity = capacity ? capacity * 2 : 4096;
+			rec->points = realloc(rec->points, capacity);
+			if (rec->points == NULL)
+				break;
+		}
+
+		if (match != last_match) {
+			if (rec->count + 1 >= start_capacity) {
+				start_capacity = start_capacity ? start_capacity * 2 : 64;
+				rec->start = realloc(rec->start, start_capacity * sizeof(*rec->start));
+				if (rec->start == NULL)
+					break;
+			}
+			rec->start[rec->count++] = rec->total;
+			last_match = match;
+		}
+
+		rec->points[rec->total++] = winner;
+	}
+
+	fclose(file);
+
+	if (rec->points == NULL || rec->start == NULL) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		return false;
+	}
+
+	if (rec->count == 0) {
+		fprintf(stderr, "%s: no points in the export\n", path);
+		return false;
+	}
+	rec->start[rec->count] = rec->total;
+
+	return true;
+}
+
+/*
+ * @brief Sets up a benchmark run.
+ * @param[in] quick Run small sizes only, as a check
+ * @param[in] verbose Print every log line of the engine
+ * @param[in] points_file CSV export of recorded matches, or NULL
+ */
+void bench_init(bool quick, bool verbose, const char *points_file)
+{
+	s_info.quick = quick;
+	s_info.verbose = verbose;
+
+	_bench_counters_open();
+
+	if (points_file && !_bench_load_recorded(points_file))
+		exit(2);
+}
+
+/*
+ * @brief Releases the counters and the recorded matches.
+ */
+void bench_fini(void)
+{
+	int i;
+
+	for (i = 0; i < BENCH_COUNTERS; i++) {
+		if (s_info.counter_fd[i] >= 0)
+			close(s_info.counter_fd[i]);
+	}
+
+	free(s_info.recorded.points);
+	free(s_info.recorded.start);
+}
+
+/*
+ * @brief Whether only small sizes are run.
+ */
+bool bench_quick(void)
+{
+	return s_info.quick;
+}
+
+/*
+ * @brief Whether the log of the engine is printed.
+ */
+bool bench_verbose(void)
+{
+	return s_info.verbose;
+}
+
+/*
+ * @brief Gets the recorded matches given with --points, NULL if none.
+ */
+const struct bench_sequences *bench_recorded(void)
+{
+	return s_info.recorded.count ? &s_info.recorded : NULL;
+}
+
+/*
+ * @brief Gets the next number of the xorshift generator of the run.
+ */
+unsigned int bench_random(void)
+{
+	unsigned int x = s_info.random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	s_info.random = x;
+
+	return x;
+}
+
+/*
+ * @brief Restarts the generator, so every benchmark sees the same points.
+ */
+void bench_seed(unsigned int seed)
+{
+	s_info.random = seed ? seed : 1;
+}
+
+/*
+ * @brief Draws the winner of a point 'me' wins with probability 'p_me'.
+ */
+key_type bench_random_point(double p_me)
+{
+	return bench_random() < p_me * 4294967296.0 ? KEY_TYPE_ME : KET_TYPE_OPPONENT;
+}
+
+/*
+ * @brief Gets the monotonic time in nanoseconds.
+ */
+unsigned long long bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * @brief Starts a measured section.
+ */
+void bench_begin(void)
+{
+	if (s_info.counters)
+		ioctl(s_info.counter_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+
+	s_info.elapsed_ns = 0;
+	bench_resume();
+}
+
+/*
+ * @brief Stops measuring, for work between the parts of a section.
+ */
+void bench_pause(void)
+{
+	if (!s_info.running)
+		return;
+
+	if (s_info.counters)
+		ioctl(s_info.counter_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	s_info.elapsed_ns += bench_now_ns() - s_info.begin_ns;
+	s_info.running = false;
+}
+
+/*
+ * @brief Measures the next part of a section.
+ */
+void bench_resume(void)
+{
+	if (s_info.running)
+		return;
+
+	s_info.running = true;
+	s_info.begin_ns = bench_now_ns();
+
+	if (s_info.counters)
+		ioctl(s_info.counter_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/*
+ * @brief Ends a measured section.
+ * @param[out] sample_out Time and counters of the section
+ */
+void bench_end(struct bench_sample *sample_out)
+{
+	unsigned long long values[1 + BENCH_COUNTERS];
+
+	bench_pause();
+
+	sample_out->ns = s_info.elapsed_ns;
+	sample_out->instructions = -1;
+	sample_out->branch_misses = -1;
+	sample_out->cache_misses = -1;
+
+	if (!s_info.counters)
+		return;
+
+	if (read(s_info.counter_fd[0], values, sizeof(values)) != sizeof(values) || values[0] != BENCH_COUNTERS)
+		return;
+
+	sample_out->instructions = values[1];
+	sample_out->branch_misses = values[2];
+	sample_out->cache_misses = values[3];
+}
+
+/*
+ * @brief Gets the resident set size of the process in kilobytes.
+ */
+long bench_rss_kb(void)
+{
+	long size;
+	long pages = -1;
+	FILE *file = fopen("/proc/self/statm", "r");
+
+	if (file == NULL)
+		return -1;
+
+	if (fscanf(file, "%ld %ld", &size, &pages) != 2)
+		pages = -1;
+	fclose(file);
+
+	return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * @brief Gets the largest resident set size of the process so far in kilobytes.
+ */
+long bench_peak_rss_kb(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+
+	return usage.ru_maxrss;
+}
+
+/*
+ * Allocation counters of the hooks below. The Makefile links every object
+ * with --wrap for malloc, calloc and realloc, so the calls of the
+ * engine and the benches land here first. The C library's own are not seen.
+ */
+static struct bench_allocs bench_allocs_seen = { 0 };
+/* Set to make the next allocation fail */
+static int bench_allocs_failing = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+/*
+ * @brief Tells whether the allocation being made has to fail, see bench_allocs_fail_next().
+ */
+static bool _bench_allocs_fail(void)
+{
+	return __atomic_exchange_n(&bench_allocs_failing, 0, __ATOMIC_RELAXED) != 0;
+}
+
+void *__wrap_malloc(size_t size)
+{
+	void *ptr = _bench_allocs_fail() ? NULL : __real_malloc(size);
+
+	if (ptr)
+		__atomic_fetch_add(&bench_allocs_seen.calls, 1, __ATOMIC_RELAXED);
+
+	return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	void *ptr = _bench_allocs_fail() ? NULL : __real_calloc(count, size);
+
+	if (ptr)
+		__atomic_fetch_add(&bench_allocs_seen.calls, 1, __ATOMIC_RELAXED);
+
+	return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	void *moved = _bench_allocs_fail() ? NULL : __real_realloc(ptr, size);
+
+	if (moved)
+		__atomic_fetch_add(&bench_allocs_seen.calls, 1, __ATOMIC_RELAXED);
+
+	return moved;
+}
+
+
+/*
+ * @brief Gets the number of allocation calls so far.
+ * A realloc counts as a call, as it may move the block.
+ */
+void bench_allocs(struct bench_allocs *allocs_out)
+{
+	allocs_out->calls = __atomic_load_n(&bench_allocs_seen.calls, __ATOMIC_RELAXED);
+}
+
+/*
+ * @brief Makes the next malloc, calloc or realloc fail, to check the error paths.
+ */
+void bench_allocs_fail_next(void)
+{
+	__atomic_store_n(&bench_allocs_failing, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * @brief Prints a counter per operation, null when it was not measured.
+ */
+static void _bench_print_counter(const char *name, long long value, long long ops)
+{
+	if (value < 0)
+		printf(",\"%s\":null", name);
+	else
+		printf(",\"%s\":%.2f", name, (double)value / ops);
+}
+
+/*
+ * @brief Prints one result as a line of JSON.
+ * @param[in] bench Name of the benchmark
+ * @param[in] name Name of the case
+ * @param[in] sample Measured section, or NULL for a result without timing
+ * @param[in] ops Number of operations in the section
+ * @param[in] extra_fmt More fields, printf format of '"key":value' pairs, or NULL
+ */
+void bench_report(const char *bench, const char *name, const struct bench_sample *sample, long long ops, const char *extra_fmt, ...)
+{
+	va_list ap;
+
+	printf("{\"bench\":\"%s\",\"case\":\"%s\",\"ops\":%lld", bench, name, ops);
+
+	if (sample && ops > 0) {
+		printf(",\"ns_per_op\":%.2f", (double)sample->ns / ops);
+		_bench_print_counter("instructions_per_op", sample->instructions, ops);
+		_bench_print_counter("branch_misses_per_op", sample->branch_misses, ops);
+		_bench_print_counter("cache_misses_per_op", sample->cache_misses, ops);
+	}
+
+	if (extra_fmt) {
+		putchar(',');
+		va_start(ap, extra_fmt);
+		vprintf(extra_fmt, ap);
+		va_end(ap);
+	}
+
+	printf("}\n");
+	fflush(stdout);
+}
+
+/*
+ * @brief Reports a wrong result, the run then exits with an error.
+ */
+void bench_fail(const char *bench, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "FAIL %s: ", bench);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+
+	s_info.failed = true;
+}
+
+/*
+ * @brief Whether any benchmark reported a wrong result.
+ */
+bool bench_failed(void)
+{
+	return s_info.failed;
+}
@@ -0,0 +1,65 @@
+#if !defined(_BENCH_H)
+#define _BENCH_H
+
+#include <main.h>
+#include "data.h"
+
+/*
+ * Hardware counters of a measured section, -1 when perf_event_open is
+ * not available (containers, perf_event_paranoid, ...).
+ */
+struct bench_sample {
+	unsigned long long ns;
+	long long instructions;
+	long long branch_misses;
+	long long cache_misses;
+};
+
+/*
+ * Allocations of the engine and the benches, see bench_allocs().
+ */
+struct bench_allocs {
+	long long calls;
+};
+
+/*
+ * Point sequences of recorded matches, one winner per point.
+ */
+struct bench_sequences {
+	unsigned char *points;
+	int *start;
+	int count;
+	int total;
+};
+
+void bench_init(bool quick, bool verbose, const char *points_file);
+void bench_fini(void);
+bool bench_quick(void);
+bool bench_verbose(void);
+const struct bench_sequences *bench_recorded(void);
+unsigned int bench_random(void);
+void bench_seed(unsigned int seed);
+key_type bench_random_point(double p_me);
+unsigned long long bench_now_ns(void);
+void bench_begin(void);
+void bench_pause(void);
+void bench_resume(void);
+void bench_end(struct bench_sample *sample_out);
+long bench_rss_kb(void);
+long bench_peak_rss_kb(void);
+void bench_allocs(struct bench_allocs *allocs_out);
+void bench_allocs_fail_next(void);
+void bench_report(const char *bench, const char *name, const struct bench_sample *sample, long long ops, const char *extra_fmt, ...);
+void bench_fail(const char *bench, const char *fmt, ...);
+bool bench_failed(void);
+
+void bench_score(void);
+void bench_merge(void);
+void bench_registry(void);
+void bench_rating(void);
+void bench_export(void);
+void bench_similarity(void);
+void bench_moment(void);
+void bench_pace(void);
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "bench.h"
+#include "match_registry.h"
+#include "export.h"
+
+#define BENCH_EXPORT_MATCHES 20000
+#define BENCH_EXPORT_QUICK_MATCHES 200
+#define BENCH_EXPORT_POINTS_MAX 300
+
+/*
+ * An export running on its own thread, like the ecore thread of the application.
+ */
+struct bench_export_thread {
+	const struct export_snapshot *snapshot;
+	int fd;
+	export_format format;
+	bool ok;
+};
+
+/*
+ * @brief Fills a registry with random matches.
+ * @return Number of points
+ */
+static long long _bench_export_fill(struct match_registry *registry, int matches)
+{
+	char my_name[32];
+	char op_name[32];
+	long long points = 0;
+	int m, i;
+
+	for (m = 0; m < matches; m++) {
+		struct match *match;
+		int count = 1 + bench_random() % BENCH_EXPORT_POINTS_MAX;
+
+		/* A quote and a comma in every few names */
+		snprintf(my_name, sizeof(my_name), m % 7 ? "player %d" : "\"player\", %d", 2 * m);
+		snprintf(op_name, sizeof(op_name), "player %d", 2 * m + 1);
+		match = match_registry_get(registry, match_registry_add(registry, my_name, op_name));
+		if (match == NULL)
+			break;
+
+		for (i = 0; i < count; i++)
+			point_log_append(&match->log, bench_random() & 1);
+		points += count;
+	}
+
+	return points;
+}
+
+/*
+ * @brief FNV-1a hash of everything written to a file.
+ * @return The hash, 0 if the file could not be read
+ */
+static unsigned long long _bench_export_hash(FILE *file, long *size_out)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	int c;
+
+	*size_out = 0;
+	fflush(file);
+	if (fseek(file, 0, SEEK_SET) != 0)
+		return 0;
+
+	while ((c = getc(file)) != EOF) {
+		hash ^= (unsigned char)c;
+		hash *= 1099511628211ULL;
+		(*size_out)++;
+	}
+
+	return hash;
+}
+
+/*
+ * @brief Writes a snapshot on another thread.
+ */
+static void *_bench_export_thread_run(void *data)
+{
+	struct bench_export_thread *export = data;
+
+	export->ok = export_snapshot_write(export->snapshot, export->fd, export->format, EXPORT_THREADS_MAX);
+
+	return NULL;
+}
+
+/*
+ * @brief Exports a snapshot while the registry keeps changing, like the
+ * main loop scoring during an export. The file must be the export of the
+ * registry as it was when the snapshot was taken.
+ */
+static void _bench_export_concurrent(struct match_registry *registry, export_format format, unsigned long long expected)
+{
+	struct bench_export_thread export = { NULL, -1, format, false };
+	FILE *file = tmpfile();
+	pthread_t tid;
+	long size;
+	int i;
+
+	export.snapshot = export_snapshot_create(registry);
+	if (file == NULL || export.snapshot == NULL) {
+		bench_fail("export", "out of memory");
+		goto out;
+	}
+	export.fd = fileno(file);
+
+	if (pthread_create(&tid, NULL, _bench_export_thread_run, &export) != 0) {
+		bench_fail("export", "pthread_create failed");
+		goto out;
+	}
+
+	/* Score, add and retire matches until the export is done, growing and moving point logs */
+	for (i = 0; i < 1000; i++) {
+		match_handle handle = match_registry_add(registry, "late", "comer");
+		struct match *match = match_registry_get(registry, handle);
+		int j;
+
+		for (j = 0; match && j < BENCH_EXPORT_POINTS_MAX; j++)
+			point_log_append(&match->log, j & 1);
+		match_registry_retire(registry, handle);
+	}
+
+	pthread_join(tid, NULL);
+
+	if (!export.ok || _bench_export_hash(file, &size) != expected)
+		bench_fail("export", "an export written while the registry changed differs from the snapshot");
+
+out:
+	export_snapshot_destroy((struct export_snapshot *)export.snapshot);
+	if (file)
+		fclose(file);
+}
+
+/*
+ * @brief Streams a large history in both formats with every thread count.
+ * Every thread count must write the same bytes, and so must an export
+ * running while the registry changes under it. The snapshot is the part
+ * the application runs on its main loop, so its cost is reported apart.
+ */
+void bench_export(void)
+{
+	static const char *format_names[] = { "csv", "json" };
+	int matches = bench_quick() ? BENCH_EXPORT_QUICK_MATCHES : BENCH_EXPORT_MATCHES;
+	struct match_registry *registry = match_registry_create();
+	struct bench_sample sample;
+	char case_name[64];
+	long long points;
+	int format;
+
+	if (registry == NULL) {
+		bench_fail("export", "match_registry_create failed");
+		return;
+	}
+
+	points = _bench_export_fill(registry, matches);
+
+	for (format = EXPORT_FORMAT_CSV; format <= EXPORT_FORMAT_JSON; format++) {
+		struct export_snapshot *snapshot;
+		unsigned long long expected = 0;
+		int threads;
+
+		bench_begin();
+		snapshot = export_snapshot_create(registry);
+		bench_end(&sample);
+		if (snapshot == NULL) {
+			bench_fail("export", "export_snapshot_create failed");
+			break;
+		}
+
+		snprintf(case_name, sizeof(case_name), "%s/snapshot", format_names[format]);
+		bench_report("export", case_name, &sample, points, "\"matches\":%d", matches);
+
+		for (threads = 1; threads <= EXPORT_THREADS_MAX; threads *= 2) {
+			FILE *file = tmpfile();
+			unsigned long long hash;
+			bool ok;
+			long size;
+
+			if (file == NULL) {
+				bench_fail("export", "tmpfile failed");
+				break;
+			}
+
+			bench_begin();
+			ok = export_snapshot_write(snapshot, fileno(file), format, threads);
+			bench_end(&sample);
+
+			hash = _bench_export_hash(file, &size);
+			fclose(file);
+
+			if (threads == 1)
+				expected = hash;
+			if (!ok || hash != expected)
+				bench_fail("export", "%s export with %d threads differs from one thread", format_names[format], threads);
+
+			snprintf(case_name, sizeof(case_name), "%s/threads=%d", format_names[format], threads);
+			bench_report("export", case_name, &sample, points, "\"matches\":%d,\"bytes\":%ld", matches, size);
+		}
+
+		export_snapshot_destroy(snapshot);
+		_bench_export_concurrent(registry, format, expected);
+	}
+
+	match_registry_destroy(registry);
+}
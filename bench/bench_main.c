@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "bench.h"
+
+/*
+ * Every benchmark of the suite. Each one prints its results as lines of
+ * JSON on stdout and calls bench_fail() when an engine disagrees with
+ * its reference, so the exit status can gate regressions.
+ */
+static const struct bench_entry {
+	const char *name;
+	void (*run)(void);
+} benches[] = {
+	{ "score", bench_score },
+	{ "merge", bench_merge },
+	{ "registry", bench_registry },
+	{ "rating", bench_rating },
+	{ "export", bench_export },
+	{ "similarity", bench_similarity },
+	{ "moment", bench_moment },
+	{ "pace", bench_pace },
+};
+
+#define BENCH_COUNT (int)(sizeof(benches) / sizeof(benches[0]))
+
+/*
+ * @brief Prints how to run the suite.
+ */
+static void _bench_usage(const char *argv0)
+{
+	int i;
+
+	fprintf(stderr, "usage: %s [-q] [-v] [-p export.csv] [bench...]\n", argv0);
+	fprintf(stderr, "  -q  quick run with small sizes, as a check\n");
+	fprintf(stderr, "  -v  print the log of the engine\n");
+	fprintf(stderr, "  -p  also replay the matches of a CSV export of the application\n");
+	fprintf(stderr, "benches:");
+	for (i = 0; i < BENCH_COUNT; i++)
+		fprintf(stderr, " %s", benches[i].name);
+	fputc('\n', stderr);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *points_file = NULL;
+	bool quick = false;
+	bool verbose = false;
+	int opt;
+	int i, j;
+
+	while ((opt = getopt(argc, argv, "qvp:h")) != -1) {
+		switch (opt) {
+		case 'q':
+			quick = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'p':
+			points_file = optarg;
+			break;
+		default:
+			_bench_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	for (i = optind; i < argc; i++) {
+		for (j = 0; j < BENCH_COUNT; j++) {
+			if (!strcmp(argv[i], benches[j].name))
+				break;
+		}
+		if (j == BENCH_COUNT) {
+			_bench_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	bench_init(quick, verbose, points_file);
+
+	for (j = 0; j < BENCH_COUNT; j++) {
+		bool selected = optind == argc;
+
+		for (i = optind; i < argc; i++)
+			selected |= !strcmp(argv[i], benches[j].name);
+
+		if (selected) {
+			bench_seed(0x5eed);
+			benches[j].run();
+		}
+	}
+
+	bench_fini();
+
+	return bench_failed() ? 1 : 0;
+}
@@ -0,0 +1,389 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "data.h"
+#include "point_log.h"
+#include "match_registry.h"
+#include "rating.h"
+
+#define BENCH_MERGE_MATCHES 2000
+#define BENCH_MERGE_QUICK_MATCHES 50
+#define BENCH_MERGE_POINTS_MAX 1000
+/* Chance that a device records the wrong winner of a point */
+#define BENCH_MERGE_ERROR_RATE 0.1
+#define BENCH_MERGE_GAP_MIN 3
+#define BENCH_MERGE_GAP_MAX 15
+/* Chance that a device misses a tap or records one twice between two syncs */
+#define BENCH_MERGE_TAP_RATE 0.3
+
+/*
+ * @brief Draws a match that goes to the fifth set.
+ * @return Number of points
+ */
+static int _bench_merge_five_setter(unsigned char *points)
+{
+	for (;;) {
+		struct match_score score = { { 0, }, { 0, } };
+		int n;
+
+		for (n = 0; n < BENCH_MERGE_POINTS_MAX; n++) {
+			key_type winner = bench_random_point(0.5);
+			bool won;
+
+			points[n] = winner;
+			won = winner == KEY_TYPE_ME ? data_score_add_point(&score.my) : data_score_add_point(&score.op);
+			if (won) {
+				/* The loser has two sets when the winner takes the fifth */
+				if ((winner == KEY_TYPE_ME ? score.op.set_won : score.my.set_won) == SET_TWO)
+					return n + 1;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * @brief Checks that every cached score of a log is the reference score of its points.
+ */
+static bool _bench_merge_check_states(const struct point_log *log)
+{
+	struct match_score score = { { 0, }, { 0, } };
+	int i;
+
+	for (i = 0; i < log->count; i++) {
+		data_match_score_add_point(&score, log->ops[i].winner);
+		if (memcmp(&score, &log->states[i], sizeof(score)))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * @brief Checks that two logs hold the same versions of the same points.
+ */
+static bool _bench_merge_same(const struct point_log *a, const struct point_log *b)
+{
+	int i;
+
+	if (a->count != b->count)
+		return false;
+
+	for (i = 0; i < a->count; i++) {
+		if (a->ops[i].clock != b->ops[i].clock || a->ops[i].device_id != b->ops[i].device_id ||
+				a->ops[i].winner != b->ops[i].winner)
+			return false;
+	}
+
+	return !memcmp(a->states, b->states, a->count * sizeof(*a->states));
+}
+
+/*
+ * @brief Checks the winners of a log against the expected points.
+ */
+static bool _bench_merge_winners(const struct point_log *log, const unsigned char *expected, int count)
+{
+	int i;
+
+	if (log->count != count)
+		return false;
+
+	for (i = 0; i < count; i++) {
+		if (log->ops[i].winner != expected[i])
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * @brief Points both devices recorded are kept once, a point only one
+ * device recorded is kept whichever device merges first, and two versions
+ * with the same name and different winners are rejected.
+ */
+static void _bench_merge_cases(void)
+{
+	static const key_type gap[] = { KEY_TYPE_ME, KET_TYPE_OPPONENT, KEY_TYPE_ME };
+	struct match_score reference = { { 0, }, { 0, } };
+	struct match_score score;
+	struct point_log a;
+	struct point_log b;
+	unsigned int i;
+
+	point_log_init(&a, 1);
+	point_log_init(&b, 2);
+
+	for (i = 0; i < 4; i++) {
+		point_log_append(&a, i & 1);
+		data_match_score_add_point(&reference, i & 1);
+	}
+	point_log_merge(&b, &a);
+
+	for (i = 0; i < sizeof(gap) / sizeof(gap[0]); i++) {
+		point_log_append(&a, gap[i]);
+		point_log_append(&b, gap[i]);
+		data_match_score_add_point(&reference, gap[i]);
+	}
+
+	point_log_merge(&a, &b);
+	point_log_merge(&b, &a);
+	point_log_get_score(&a, &score);
+	if (a.count != 7 || memcmp(&score, &reference, sizeof(score)) || !_bench_merge_same(&a, &b))
+		bench_fail("merge", "points recorded by both devices: %d points after the merge, expected 7", a.count);
+
+	/* Device 2 misses the first tap of a round, and records the last one of the next round twice */
+	for (i = 0; i < 2; i++) {
+		static const key_type taps_a[2][4] = {
+			{ KEY_TYPE_ME, KET_TYPE_OPPONENT, KEY_TYPE_ME },
+			{ KET_TYPE_OPPONENT, KET_TYPE_OPPONENT, KEY_TYPE_ME },
+		};
+		static const key_type taps_b[2][4] = {
+			{ KET_TYPE_OPPONENT, KEY_TYPE_ME },
+			{ KET_TYPE_OPPONENT, KET_TYPE_OPPONENT, KEY_TYPE_ME, KEY_TYPE_ME },
+		};
+		static const int count_a[2] = { 3, 3 };
+		static const int count_b[2] = { 2, 4 };
+		static const unsigned char expected[] = { 0, 1, 0, 1, 0, 1, 1, 0, 0 };
+		int r, t;
+
+		point_log_reset(&a);
+		point_log_reset(&b);
+		point_log_append(&a, KEY_TYPE_ME);
+		point_log_append(&a, KET_TYPE_OPPONENT);
+		point_log_merge(&b, &a);
+
+		for (r = 0; r < 2; r++) {
+			for (t = 0; t < count_a[r]; t++)
+				point_log_append(&a, taps_a[r][t]);
+			for (t = 0; t < count_b[r]; t++)
+				point_log_append(&b, taps_b[r][t]);
+
+			if (i == 0) {
+				point_log_merge(&a, &b);
+				point_log_merge(&b, &a);
+			} else {
+				point_log_merge(&b, &a);
+				point_log_merge(&a, &b);
+			}
+		}
+
+		if (!_bench_merge_winners(&a, expected, sizeof(expected)) || !_bench_merge_same(&a, &b) || !_bench_merge_check_states(&a))
+			bench_fail("merge", "a missed and an extra tap: %d points after the merge, expected %d", a.count, (int)sizeof(expected));
+	}
+
+	/* Both devices left with the same id record different winners */
+	point_log_fini(&a);
+	point_log_fini(&b);
+	point_log_init(&a, 0);
+	point_log_init(&b, 0);
+	point_log_append(&a, KEY_TYPE_ME);
+	point_log_append(&b, KET_TYPE_OPPONENT);
+	if (point_log_merge(&a, &b) >= 0 || a.count != 1 || a.ops[0].winner != KEY_TYPE_ME)
+		bench_fail("merge", "two versions of point 0 of device 0 were merged");
+
+	point_log_fini(&a);
+	point_log_fini(&b);
+
+	bench_report("merge", "cases", NULL, 4, NULL);
+}
+
+/*
+ * @brief Records the taps of one device between two syncs.
+ * @param[in] seen The winner of each point as the device saw it
+ * @param[in] skip Point the device missed, -1 for none
+ * @param[in] twice Point the device recorded twice, -1 for none
+ */
+static void _bench_merge_taps(struct point_log *log, const unsigned char *seen, int first, int count, int skip, int twice)
+{
+	int i;
+
+	for (i = first; i < first + count; i++) {
+		if (i == skip)
+			continue;
+		point_log_append(log, seen[i]);
+		if (i == twice)
+			point_log_append(log, seen[i]);
+	}
+}
+
+/*
+ * @brief Two devices score long five-setters and sync after every gap.
+ * With 'taps' unset both devices record every point and get some winners
+ * wrong: the merge must hold the winners of device 1, which has the lower
+ * id, so a point both devices got right stays right. With 'taps' set the
+ * winners are right but a device misses a tap or records one twice
+ * between some syncs: the merge must hold every real point and every
+ * extra tap. In both cases the logs must converge to the same points and
+ * every cached score must be the reference one.
+ */
+static void _bench_merge_five_setters(const char *name, bool taps)
+{
+	static unsigned char truth[BENCH_MERGE_POINTS_MAX];
+	static unsigned char seen[2][BENCH_MERGE_POINTS_MAX];
+	static unsigned char expected[2 * BENCH_MERGE_POINTS_MAX];
+	int matches = bench_quick() ? BENCH_MERGE_QUICK_MATCHES : BENCH_MERGE_MATCHES;
+	long long merges = 0;
+	long long replayed = 0;
+	long long full = 0;
+	long long points = 0;
+	long long disagreements = 0;
+	long long tap_errors = 0;
+	struct bench_sample sample;
+	struct point_log a;
+	struct point_log b;
+	int m;
+
+	point_log_init(&a, 1);
+	point_log_init(&b, 2);
+
+	/* Only the merges are measured */
+	bench_begin();
+	bench_pause();
+
+	for (m = 0; m < matches; m++) {
+		int count = _bench_merge_five_setter(truth);
+		int expected_count = 0;
+		int synced = 0;
+		int i;
+
+		point_log_reset(&a);
+		point_log_reset(&b);
+
+		for (i = 0; i < count; i++) {
+			double error_rate = taps ? 0.0 : BENCH_MERGE_ERROR_RATE;
+
+			seen[0][i] = bench_random_point(error_rate) == KEY_TYPE_ME ? !truth[i] : truth[i];
+			seen[1][i] = bench_random_point(error_rate) == KEY_TYPE_ME ? !truth[i] : truth[i];
+			disagreements += seen[0][i] != seen[1][i];
+		}
+
+		while (synced < count) {
+			int gap = BENCH_MERGE_GAP_MIN + bench_random() % (BENCH_MERGE_GAP_MAX - BENCH_MERGE_GAP_MIN + 1);
+			int skip[2] = { -1, -1 };
+			int twice[2] = { -1, -1 };
+			int diverge;
+
+			if (gap > count - synced)
+				gap = count - synced;
+
+			/* At most one tap error between two syncs */
+			if (taps && bench_random_point(BENCH_MERGE_TAP_RATE) == KEY_TYPE_ME) {
+				int device = bench_random() & 1;
+				int point = synced + bench_random() % gap;
+
+				if (bench_random() & 1)
+					skip[device] = point;
+				else
+					twice[device] = point;
+				tap_errors++;
+			}
+
+			_bench_merge_taps(&a, seen[0], synced, gap, skip[0], twice[0]);
+			_bench_merge_taps(&b, seen[1], synced, gap, skip[1], twice[1]);
+
+			for (i = synced; i < synced + gap; i++) {
+				expected[expected_count++] = taps ? truth[i] : seen[0][i];
+				if (i == twice[0] || i == twice[1])
+					expected[expected_count++] = truth[i];
+			}
+			synced += gap;
+
+			/* Alternate which device receives first */
+			bench_resume();
+			if (merges & 2) {
+				diverge = point_log_merge(&a, &b);
+				replayed += a.count - diverge;
+				diverge = point_log_merge(&b, &a);
+				replayed += b.count - diverge;
+			} else {
+				diverge = point_log_merge(&b, &a);
+				replayed += b.count - diverge;
+				diverge = point_log_merge(&a, &b);
+				replayed += a.count - diverge;
+			}
+			bench_pause();
+			merges += 2;
+			full += a.count + b.count;
+
+			if (!_bench_merge_same(&a, &b)) {
+				bench_fail("merge", "%s: logs did not converge in match %d after %d points", name, m, synced);
+				break;
+			}
+		}
+
+		if (!_bench_merge_check_states(&a))
+			bench_fail("merge", "%s: cached scores differ from the reference in match %d", name, m);
+		if (!_bench_merge_winners(&a, expected, expected_count))
+			bench_fail("merge", "%s: match %d has %d points after merging, not the %d expected ones", name, m, a.count, expected_count);
+		points += count;
+	}
+
+	bench_end(&sample);
+	bench_report("merge", name, &sample, merges,
+			"\"matches\":%d,\"points\":%lld,\"disagreements\":%lld,\"tap_errors\":%lld,\"points_replayed\":%lld,\"points_full_replay\":%lld",
+			matches, points, disagreements, tap_errors, replayed, full);
+
+	point_log_fini(&a);
+	point_log_fini(&b);
+}
+
+/*
+ * @brief A merge that moves the win of the active match must rate and index
+ * the match on the new win only.
+ */
+static void _bench_merge_data(void)
+{
+	static button_score button = { .button = NULL, .button_type = KEY_TYPE_ME, .button_name = "bench" };
+	int love_match = SET_MATCH * 6 * 4;
+	struct rating_player player;
+	struct point_log remote;
+	struct match *match;
+	int i;
+
+	if (!data_initialize() || !data_compile_moments()) {
+		bench_fail("merge", "data_initialize or data_compile_moments failed");
+		data_finalize();
+		return;
+	}
+
+	/* The other device has the lower id, so its versions are kept */
+	data_set_device_id(2);
+	point_log_init(&remote, 1);
+	match = match_registry_get(data_get_registry(), data_get_active_match());
+
+	for (i = 0; i < love_match; i++)
+		data_add_my_score(&button);
+	if (!match->finished || !rating_engine_get(data_get_ratings(), match->my_name, &player) || player.matches != 1)
+		bench_fail("merge", "a love match scored here was not rated");
+
+	/* The other device gave the last point to the opponent, the match is not over */
+	for (i = 0; i < love_match - 1; i++)
+		point_log_append(&remote, KEY_TYPE_ME);
+	point_log_append(&remote, KET_TYPE_OPPONENT);
+	data_merge_point_log(&remote);
+	if (match->finished || match->similar_item >= 0 || rating_engine_get(data_get_ratings(), match->my_name, &player))
+		bench_fail("merge", "a match whose win a merge took back is still rated or indexed");
+
+	/* And the next point to me, which wins it */
+	point_log_append(&remote, KEY_TYPE_ME);
+	data_merge_point_log(&remote);
+	if (!match->finished || match->win_points != love_match + 1 || match->similar_item < 0 ||
+			!rating_engine_get(data_get_ratings(), match->my_name, &player) || player.matches != 1)
+		bench_fail("merge", "a match won again by a merge was not rated and indexed once");
+
+	point_log_fini(&remote);
+	data_finalize();
+
+	bench_report("merge", "data", NULL, 3, NULL);
+}
+
+/*
+ * @brief Merge cases, then five-setters with wrong winners and with missed and extra taps.
+ */
+void bench_merge(void)
+{
+	_bench_merge_cases();
+	_bench_merge_data();
+	_bench_merge_five_setters("five_setters", false);
+	_bench_merge_five_setters("five_setters_taps", true);
+}
@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "data.h"
+#include "point_log.h"
+#include "match_registry.h"
+#include "moment.h"
+#include "rating.h"
+
+#define BENCH_MOMENT_MATCHES 10000
+#define BENCH_MOMENT_QUICK_MATCHES 200
+#define BENCH_MOMENT_MERGE_MATCHES 1000
+#define BENCH_MOMENT_QUICK_MERGE_MATCHES 20
+#define BENCH_MOMENT_POINTS_MAX 1000
+/* Chance that this device records the wrong winner of a point */
+#define BENCH_MOMENT_ERROR_RATE 0.05
+#define BENCH_MOMENT_GAP_MIN 3
+#define BENCH_MOMENT_GAP_MAX 15
+/* Points at the end of a match only the other device records */
+#define BENCH_MOMENT_TAIL_MAX 10
+
+/*
+ * A moment rule and the condition it stands for, written out directly.
+ */
+enum {
+	BENCH_MOMENT_BREAK_POINT_ME,
+	BENCH_MOMENT_BREAK_POINT_OP,
+	BENCH_MOMENT_MATCH_POINT_ME,
+	BENCH_MOMENT_MATCH_POINT_OP,
+	BENCH_MOMENT_MOMENTUM_ME,
+	BENCH_MOMENT_MOMENTUM_OP,
+	BENCH_MOMENT_DIRECT_COUNT,
+};
+
+static const char *bench_moment_direct_names[BENCH_MOMENT_DIRECT_COUNT] = {
+	"break_point_me",
+	"break_point_op",
+	"match_point_me",
+	"match_point_op",
+	"momentum_me",
+	"momentum_op",
+};
+
+static button_score bench_button = {
+	.button = NULL,
+	.button_type = KEY_TYPE_ME,
+	.button_name = "bench",
+};
+
+/*
+ * @brief Scores a random match up to the point that wins it.
+ */
+static void _bench_moment_match(struct point_log *log)
+{
+	double p_me = 0.3 + 0.4 * bench_random() / 4294967296.0;
+	int n;
+
+	point_log_reset(log);
+	for (n = 0; n < BENCH_MOMENT_POINTS_MAX; n++) {
+		point_log_append(log, bench_random_point(p_me));
+		if (point_log_wins_match(log, n))
+			break;
+	}
+}
+
+/*
+ * @brief Feeds a whole match to a fresh detector.
+ */
+static void _bench_moment_replay(const struct moment_rules *rules, const struct point_log *log, int count, struct moment_stream *stream_out)
+{
+	int i;
+
+	moment_stream_init(stream_out);
+	for (i = 0; i < count; i++)
+		moment_stream_feed(rules, stream_out, log->ops[i].winner, &log->states[i]);
+}
+
+/*
+ * @brief Checks the rules with a plain definition against their conditions after every point.
+ * @param[in] fired What the rules fired on each point of the match
+ */
+static bool _bench_moment_check_direct(const struct moment_rules *rules, const struct point_log *log, const unsigned int *fired)
+{
+	unsigned int bits[BENCH_MOMENT_DIRECT_COUNT] = { 0, };
+	int run_me = 0;
+	int run_op = 0;
+	int games_played = 0;
+	int i, r;
+
+	for (r = 0; r < BENCH_MOMENT_DIRECT_COUNT; r++) {
+		for (i = 0; i < moment_rules_count(rules); i++) {
+			if (!strcmp(moment_rules_name(rules, i), bench_moment_direct_names[r]))
+				bits[r] = 1u << i;
+		}
+		if (bits[r] == 0)
+			return false;
+	}
+
+	for (i = 0; i < log->count; i++) {
+		const struct match_score *after = &log->states[i];
+		key_type winner = log->ops[i].winner;
+		bool expected[BENCH_MOMENT_DIRECT_COUNT];
+		bool srv_me;
+
+		if ((winner == KEY_TYPE_ME ? after->my.point_won : after->op.point_won) == POINT_LOVE)
+			games_played++;
+		srv_me = (games_played & 1) == 0;
+
+		run_me = winner == KEY_TYPE_ME ? run_me + 1 : 0;
+		run_op = winner == KEY_TYPE_ME ? 0 : run_op + 1;
+
+		expected[BENCH_MOMENT_BREAK_POINT_ME] = after->my.point_won == POINT_40 && !srv_me;
+		expected[BENCH_MOMENT_BREAK_POINT_OP] = after->op.point_won == POINT_40 && srv_me;
+		expected[BENCH_MOMENT_MATCH_POINT_ME] = after->my.point_won == POINT_40 && after->my.game_won == GAME_FIVE &&
+				after->my.set_won == SET_MATCH - 1;
+		expected[BENCH_MOMENT_MATCH_POINT_OP] = after->op.point_won == POINT_40 && after->op.game_won == GAME_FIVE &&
+				after->op.set_won == SET_MATCH - 1;
+		expected[BENCH_MOMENT_MOMENTUM_ME] = run_me >= 6;
+		expected[BENCH_MOMENT_MOMENTUM_OP] = run_op >= 6;
+
+		for (r = 0; r < BENCH_MOMENT_DIRECT_COUNT; r++) {
+			if (!(fired[i] & bits[r]) != !expected[r])
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * @brief Feeds the points of many matches in turn, like a registry scoring
+ * them at once. Every match must fire what it fires when fed alone, and the
+ * rules with a plain definition must fire exactly when it holds.
+ */
+static void _bench_moment_interleaved(const struct moment_rules *rules)
+{
+	int matches = bench_quick() ? BENCH_MOMENT_QUICK_MATCHES : BENCH_MOMENT_MATCHES;
+	struct point_log *logs = calloc(matches, sizeof(*logs));
+	struct moment_stream *streams = calloc(matches, sizeof(*streams));
+	unsigned int **fired = calloc(matches, sizeof(*fired));
+	struct bench_sample sample;
+	long long points = 0;
+	long long events = 0;
+	int m, i, p;
+
+	if (logs == NULL || streams == NULL || fired == NULL) {
+		bench_fail("moment", "out of memory");
+		goto out;
+	}
+
+	for (m = 0; m < matches; m++) {
+		point_log_init(&logs[m], 1);
+		_bench_moment_match(&logs[m]);
+		fired[m] = malloc(logs[m].count * sizeof(**fired));
+		if (fired[m] == NULL) {
+			bench_fail("moment", "out of memory");
+			goto out;
+		}
+		moment_stream_init(&streams[m]);
+		points += logs[m].count;
+	}
+
+	/* One point of every match still going at a time */
+	bench_begin();
+	for (p = 0, i = matches; i > 0; p++) {
+		for (m = 0, i = 0; m < matches; m++) {
+			if (p >= logs[m].count)
+				continue;
+			fired[m][p] = moment_stream_feed(rules, &streams[m], logs[m].ops[p].winner, &logs[m].states[p]);
+			i++;
+		}
+	}
+	bench_end(&sample);
+
+	for (m = 0; m < matches; m++) {
+		struct moment_stream alone;
+
+		moment_stream_init(&alone);
+		for (p = 0; p < logs[m].count; p++) {
+			unsigned int bits = moment_stream_feed(rules, &alone, logs[m].ops[p].winner, &logs[m].states[p]);
+
+			if (bits != fired[m][p]) {
+				bench_fail("moment", "match %d fired %#x on point %d among others, %#x alone", m, fired[m][p], p, bits);
+				break;
+			}
+			for (; bits; bits &= bits - 1)
+				events++;
+		}
+
+		if (!_bench_moment_check_direct(rules, &logs[m], fired[m])) {
+			bench_fail("moment", "match %d fired a rule when its condition did not hold, or missed one", m);
+			break;
+		}
+	}
+
+	bench_report("moment", "interleaved", &sample, points, "\"matches\":%d,\"rules\":%d,\"moments\":%lld",
+			matches, moment_rules_count(rules), events);
+
+out:
+	for (m = 0; logs && fired && m < matches; m++) {
+		point_log_fini(&logs[m]);
+		free(fired[m]);
+	}
+	free(logs);
+	free(streams);
+	free(fired);
+}
+
+/*
+ * @brief Scores matches on this device while another one sends the right
+ * winners every few points, and only the other device records the last
+ * points. The detector must end each merge where a replay of the whole
+ * match from the first point ends, every new point must be in the pace,
+ * and every match must be rated once, most of them won by a merge.
+ */
+static void _bench_moment_merge(const struct moment_rules *rules)
+{
+	int matches = bench_quick() ? BENCH_MOMENT_QUICK_MERGE_MATCHES : BENCH_MOMENT_MERGE_MATCHES;
+	struct rating_player player = { 0, };
+	struct bench_sample sample;
+	struct point_log truth;
+	struct point_log remote;
+	long long merges = 0;
+	long long fed = 0;
+	long long full = 0;
+	match_handle previous = MATCH_HANDLE_INVALID;
+	int m, i;
+
+	if (!data_initialize() || !data_compile_moments()) {
+		bench_fail("moment", "data_initialize or data_compile_moments failed");
+		data_finalize();
+		return;
+	}
+
+	/* The other device has the lower id, so its versions are kept */
+	data_set_device_id(2);
+	point_log_init(&truth, 1);
+	point_log_init(&remote, 1);
+
+	bench_begin();
+	bench_pause();
+
+	for (m = 0; m < matches; m++) {
+		struct match *match;
+		struct moment_stream replay;
+		int tail = 1 + bench_random() % BENCH_MOMENT_TAIL_MAX;
+		int synced = 0;
+
+		_bench_moment_match(&truth);
+		point_log_reset(&remote);
+
+		data_set_active_match(data_add_match(DATA_MY_NAME, DATA_OP_NAME));
+		if (previous != MATCH_HANDLE_INVALID)
+			data_retire_match(previous);
+		previous = data_get_active_match();
+		match = match_registry_get(data_get_registry(), previous);
+
+		while (synced < truth.count) {
+			int gap = BENCH_MOMENT_GAP_MIN + bench_random() % (BENCH_MOMENT_GAP_MAX - BENCH_MOMENT_GAP_MIN + 1);
+			int diverge;
+
+			if (gap > truth.count - synced)
+				gap = truth.count - synced;
+
+			for (i = synced; i < synced + gap; i++) {
+				key_type winner = truth.ops[i].winner;
+
+				point_log_append(&remote, winner);
+				if (i >= truth.count - tail)
+					continue;
+				if (bench_random_point(BENCH_MOMENT_ERROR_RATE) == KEY_TYPE_ME)
+					winner = winner == KEY_TYPE_ME ? KET_TYPE_OPPONENT : KEY_TYPE_ME;
+				if (winner == KEY_TYPE_ME)
+					data_add_my_score(&bench_button);
+				else
+					data_add_opponent_score(&bench_button);
+			}
+			synced += gap;
+
+			for (diverge = 0; diverge < match->log.count && match->log.ops[diverge].winner == remote.ops[diverge].winner; diverge++)
+				;
+
+			bench_resume();
+			data_merge_point_log(&remote);
+			bench_pause();
+
+			merges++;
+			if (diverge < remote.count) {
+				fed += remote.count - diverge / MOMENT_CHECKPOINT_POINTS * MOMENT_CHECKPOINT_POINTS;
+				full += remote.count;
+			}
+
+			_bench_moment_replay(rules, &match->log, match->log.count, &replay);
+			if (memcmp(&replay, &match->moments, sizeof(replay))) {
+				bench_fail("moment", "match %d: detector after a merge differs from a full replay", m);
+				break;
+			}
+		}
+
+		if (match->log.count != truth.count || match->pace.points != truth.count) {
+			bench_fail("moment", "match %d: %d points in the log, %d in the pace, expected %d", m,
+					match->log.count, match->pace.points, truth.count);
+			break;
+		}
+
+		if (!match->finished || match->similar_item < 0 ||
+				!rating_engine_get(data_get_ratings(), match->my_name, &player) || player.matches != (unsigned int)m + 1) {
+			bench_fail("moment", "match %d won by a merge was not rated and indexed once", m);
+			break;
+		}
+	}
+
+	bench_end(&sample);
+	bench_report("moment", "merge", &sample, merges, "\"matches\":%d,\"points_fed\":%lld,\"points_full_replay\":%lld",
+			matches, fed, full);
+
+	point_log_fini(&truth);
+	point_log_fini(&remote);
+	data_finalize();
+}
+
+/*
+ * @brief Scores the first half of a match before the rules are compiled, as
+ * the application does before its first frame. Once compiled, the detector
+ * must end where a replay of the whole match ends.
+ */
+static void _bench_moment_late_rules(const struct moment_rules *rules)
+{
+	struct moment_stream replay;
+	struct point_log truth;
+	struct match *match;
+	int i;
+
+	if (!data_initialize()) {
+		bench_fail("moment", "data_initialize failed");
+		return;
+	}
+
+	point_log_init(&truth, 1);
+	_bench_moment_match(&truth);
+	match = match_registry_get(data_get_registry(), data_get_active_match());
+
+	for (i = 0; i < truth.count; i++) {
+		if (i == truth.count / 2 && !data_compile_moments()) {
+			bench_fail("moment", "data_compile_moments failed");
+			goto out;
+		}
+		if (truth.ops[i].winner == KEY_TYPE_ME)
+			data_add_my_score(&bench_button);
+		else
+			data_add_opponent_score(&bench_button);
+	}
+
+	_bench_moment_replay(rules, &match->log, match->log.count, &replay);
+	if (memcmp(&replay, &match->moments, sizeof(replay)))
+		bench_fail("moment", "detector of a match scored before the rules were compiled differs from a full replay");
+
+	bench_report("moment", "late_rules", NULL, truth.count, "\"points_before_rules\":%d", truth.count / 2);
+
+out:
+	point_log_fini(&truth);
+	data_finalize();
+}
+
+/*
+ * @brief Cost per point of the default key moment rules over many matches
+ * scored at once, and cost of the merges that rescore the end of a match.
+ */
+void bench_moment(void)
+{
+	struct moment_rules *rules = moment_rules_compile(MOMENT_DEFAULT_RULES);
+
+	if (rules == NULL) {
+		bench_fail("moment", "moment_rules_compile failed");
+		return;
+	}
+
+	_bench_moment_interleaved(rules);
+	_bench_moment_merge(rules);
+	_bench_moment_late_rules(rules);
+
+	moment_rules_destroy(rules);
+}
@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "pace.h"
+
+#define BENCH_PACE_MATCHES 2000
+#define BENCH_PACE_QUICK_MATCHES 50
+/* Points of a long five-set match, with a few tiebreaks */
+#define BENCH_PACE_POINTS 420
+/* Deciseconds the pace keeps an interval to, longer ones are clamped */
+#define BENCH_PACE_INTERVAL_MAX 16383
+/* Bytes of the export of a full window, at most three per interval */
+#define BENCH_PACE_EXPORT_MAX (3 * PACE_WINDOW)
+
+/*
+ * The pace of a match written out directly: every interval ever recorded,
+ * in order, so the window is its last PACE_WINDOW entries.
+ */
+struct bench_pace_model {
+	unsigned short ds[BENCH_PACE_POINTS];
+	unsigned char kind[BENCH_PACE_POINTS];
+	int count;
+	int points;
+	bool timed;
+	pace_interval next_kind;
+	unsigned long long last_ms;
+	long long changeover_total;
+	int changeovers;
+};
+
+/*
+ * @brief Records a point in the model, as pace_record_point() should.
+ * @return The event the point should raise
+ */
+static pace_event _bench_pace_model_point(struct bench_pace_model *model, unsigned long long now_ms, pace_interval next)
+{
+	pace_interval kind = model->next_kind;
+	unsigned long long ds;
+	bool first = model->points++ == 0 || !model->timed;
+
+	model->next_kind = next;
+	model->timed = true;
+	ds = (now_ms - model->last_ms) / 100;
+	model->last_ms = now_ms;
+	if (first)
+		return PACE_EVENT_NONE;
+
+	if (ds > BENCH_PACE_INTERVAL_MAX)
+		ds = BENCH_PACE_INTERVAL_MAX;
+	model->ds[model->count] = ds;
+	model->kind[model->count] = kind;
+	model->count++;
+
+	switch (kind) {
+	case PACE_INTERVAL_POINT:
+		return ds > PACE_SERVE_CLOCK_DS + PACE_RALLY_ALLOWANCE_DS ? PACE_EVENT_SLOW_POINT : PACE_EVENT_NONE;
+	case PACE_INTERVAL_CHANGEOVER:
+		model->changeovers++;
+		model->changeover_total += ds;
+		return ds > PACE_CHANGEOVER_LIMIT_DS + PACE_RALLY_ALLOWANCE_DS ? PACE_EVENT_SLOW_CHANGEOVER : PACE_EVENT_NONE;
+	default:
+		model->changeovers++;
+		model->changeover_total += ds;
+		return ds > PACE_SET_BREAK_LIMIT_DS + PACE_RALLY_ALLOWANCE_DS ? PACE_EVENT_SLOW_CHANGEOVER : PACE_EVENT_NONE;
+	}
+}
+
+/*
+ * @brief Records a point of unknown time in the model.
+ */
+static void _bench_pace_model_untimed(struct bench_pace_model *model, pace_interval next)
+{
+	model->next_kind = next;
+	model->points++;
+	model->timed = false;
+}
+
+static int _bench_pace_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * @brief Lower median of the point intervals of the window, in one-second buckets.
+ */
+static int _bench_pace_model_median(const struct bench_pace_model *model)
+{
+	int buckets[PACE_WINDOW];
+	int n = 0;
+	int i;
+
+	for (i = model->count > PACE_WINDOW ? model->count - PACE_WINDOW : 0; i < model->count; i++) {
+		if (model->kind[i] == PACE_INTERVAL_POINT)
+			buckets[n++] = model->ds[i] / 10 < PACE_BUCKETS ? model->ds[i] / 10 : PACE_BUCKETS - 1;
+	}
+
+	if (n == 0)
+		return -1;
+
+	qsort(buckets, n, sizeof(*buckets), _bench_pace_cmp);
+
+	return buckets[(n - 1) / 2];
+}
+
+/*
+ * @brief Decodes an export and checks it holds the window of the model, oldest first.
+ */
+static bool _bench_pace_check_export(const struct pace_series *series, const struct bench_pace_model *model)
+{
+	unsigned char buf[BENCH_PACE_EXPORT_MAX];
+	int size = pace_export(series, buf, sizeof(buf));
+	int i = model->count > PACE_WINDOW ? model->count - PACE_WINDOW : 0;
+	int pos = 0;
+
+	if (size < 0)
+		return false;
+
+	for (; i < model->count; i++) {
+		unsigned int value = 0;
+		int shift = 0;
+
+		do {
+			if (pos == size)
+				return false;
+			value |= (unsigned int)(buf[pos] & 0x7f) << shift;
+			shift += 7;
+		} while (buf[pos++] & 0x80);
+
+		if (value >> 2 != model->ds[i] || (value & 3) != model->kind[i])
+			return false;
+	}
+
+	/* Nothing after the window, and a buffer one byte short is refused */
+	return pos == size && (size == 0 || pace_export(series, buf, size - 1) == -1);
+}
+
+/*
+ * @brief Checks the boundaries of the slow rules and of the median.
+ * An interval holds the rally as well as the break, so it is only slow
+ * past the limit of the break plus PACE_RALLY_ALLOWANCE_DS.
+ */
+static void _bench_pace_edges(void)
+{
+	static const struct {
+		pace_interval kind;
+		unsigned int ds;
+		pace_event event;
+	} cases[] = {
+		{ PACE_INTERVAL_POINT, PACE_SERVE_CLOCK_DS + PACE_RALLY_ALLOWANCE_DS, PACE_EVENT_NONE },
+		{ PACE_INTERVAL_POINT, PACE_SERVE_CLOCK_DS + PACE_RALLY_ALLOWANCE_DS + 1, PACE_EVENT_SLOW_POINT },
+		{ PACE_INTERVAL_CHANGEOVER, PACE_CHANGEOVER_LIMIT_DS + PACE_RALLY_ALLOWANCE_DS, PACE_EVENT_NONE },
+		{ PACE_INTERVAL_CHANGEOVER, PACE_CHANGEOVER_LIMIT_DS + PACE_RALLY_ALLOWANCE_DS + 1, PACE_EVENT_SLOW_CHANGEOVER },
+		{ PACE_INTERVAL_SET_BREAK, PACE_SET_BREAK_LIMIT_DS + PACE_RALLY_ALLOWANCE_DS, PACE_EVENT_NONE },
+		{ PACE_INTERVAL_SET_BREAK, PACE_SET_BREAK_LIMIT_DS + PACE_RALLY_ALLOWANCE_DS + 1, PACE_EVENT_SLOW_CHANGEOVER },
+	};
+	static const unsigned long long even_ms[] = { 0, 5000, 10000, 30000, 50000 };
+	struct pace_series series;
+	unsigned long long now;
+	unsigned int c;
+	int i;
+
+	for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+		pace_event event;
+
+		pace_series_init(&series);
+		pace_record_point(&series, 1000, cases[c].kind);
+		/* 99 ms over the limit still rounds down to it */
+		event = pace_record_point(&series, 1000 + cases[c].ds * 100 + 99, PACE_INTERVAL_POINT);
+		if (event != cases[c].event || series.slow_intervals != (event != PACE_EVENT_NONE)) {
+			bench_fail("pace", "interval of kind %d and %u ds raised %d, expected %d", cases[c].kind, cases[c].ds, event, cases[c].event);
+			return;
+		}
+	}
+
+	/* No interval yet, and a changeover is not a point interval */
+	pace_series_init(&series);
+	if (pace_median_point_interval(&series) != -1 || pace_mean_changeover(&series) != -1)
+		bench_fail("pace", "an empty pace has a median or a mean changeover");
+	pace_record_point(&series, 0, PACE_INTERVAL_CHANGEOVER);
+	pace_record_point(&series, 60000, PACE_INTERVAL_POINT);
+	if (pace_median_point_interval(&series) != -1 || pace_mean_changeover(&series) != 600)
+		bench_fail("pace", "a lone changeover gave a median of %d and a mean changeover of %d",
+				pace_median_point_interval(&series), pace_mean_changeover(&series));
+
+	/* Even count: the lower of the two middle buckets */
+	pace_series_init(&series);
+	for (i = 0; i < 5; i++)
+		pace_record_point(&series, even_ms[i], PACE_INTERVAL_POINT);
+	if (pace_median_point_interval(&series) != 5)
+		bench_fail("pace", "median of 5, 5, 20 and 20 s is %d", pace_median_point_interval(&series));
+
+	/* A rain delay lands in the last bucket and is clamped in the export */
+	pace_series_init(&series);
+	pace_record_point(&series, 0, PACE_INTERVAL_POINT);
+	pace_record_point(&series, 3600000, PACE_INTERVAL_POINT);
+	if (pace_median_point_interval(&series) != PACE_BUCKETS - 1 || (series.interval[0] & BENCH_PACE_INTERVAL_MAX) != BENCH_PACE_INTERVAL_MAX)
+		bench_fail("pace", "an hour between points gave a median of %d s", pace_median_point_interval(&series));
+
+	/* A full window of 1 s intervals, then one of 30 s each: the median moves once half of them are out */
+	pace_series_init(&series);
+	for (i = 0, now = 0; i <= PACE_WINDOW; i++, now += 1000)
+		pace_record_point(&series, now, PACE_INTERVAL_POINT);
+	for (i = 1; i <= PACE_WINDOW; i++) {
+		int expected = i * 2 > PACE_WINDOW ? 30 : 1;
+
+		now += 30000;
+		pace_record_point(&series, now, PACE_INTERVAL_POINT);
+		if (series.count != PACE_WINDOW || series.point_count != PACE_WINDOW || pace_median_point_interval(&series) != expected) {
+			bench_fail("pace", "%d slow intervals into a full window: median %d, expected %d", i,
+					pace_median_point_interval(&series), expected);
+			break;
+		}
+	}
+
+	bench_report("pace", "edges", NULL, sizeof(cases) / sizeof(cases[0]), NULL);
+}
+
+/*
+ * @brief Plays long matches with changeovers, set breaks, rain delays and
+ * points merged from another device, and checks the pace against the model
+ * after every point: the events, the median over the window as intervals
+ * are evicted, the mean changeover and the export.
+ */
+static void _bench_pace_matches(void)
+{
+	int matches = bench_quick() ? BENCH_PACE_QUICK_MATCHES : BENCH_PACE_MATCHES;
+	struct bench_pace_model *model = malloc(sizeof(*model));
+	pace_interval *next = malloc(BENCH_PACE_POINTS * sizeof(*next));
+	unsigned long long *end_ms = malloc(BENCH_PACE_POINTS * sizeof(*end_ms));
+	unsigned char *untimed = malloc(BENCH_PACE_POINTS * sizeof(*untimed));
+	struct bench_sample sample;
+	struct pace_series series;
+	long long points = 0;
+	long long slow = 0;
+	int m, i;
+
+	if (model == NULL || next == NULL || end_ms == NULL || untimed == NULL) {
+		bench_fail("pace", "out of memory");
+		goto out;
+	}
+
+	bench_begin();
+	bench_pause();
+
+	for (m = 0; m < matches; m++) {
+		unsigned long long now = 1000000;
+		bool failed = false;
+
+		for (i = 0; i < BENCH_PACE_POINTS; i++) {
+			unsigned int r = bench_random();
+			pace_interval kind = i == 0 ? PACE_INTERVAL_POINT : next[i - 1];
+			unsigned long long ds;
+
+			if (kind == PACE_INTERVAL_CHANGEOVER)
+				ds = PACE_CHANGEOVER_LIMIT_DS - 100 + r % 300;
+			else if (kind == PACE_INTERVAL_SET_BREAK)
+				ds = PACE_SET_BREAK_LIMIT_DS - 100 + r % 300;
+			else if (r % 500 == 0)
+				ds = 20000 + r % 20000;
+			else
+				ds = 150 + r % 300;
+			now += ds * 100 + r % 100;
+			end_ms[i] = now;
+
+			r = bench_random();
+			next[i] = r % 40 == 0 ? PACE_INTERVAL_SET_BREAK : r % 8 == 0 ? PACE_INTERVAL_CHANGEOVER : PACE_INTERVAL_POINT;
+			untimed[i] = r % 29 == 0;
+		}
+
+		/* Only the recording itself is timed */
+		pace_series_init(&series);
+		bench_resume();
+		for (i = 0; i < BENCH_PACE_POINTS; i++) {
+			if (untimed[i])
+				pace_record_untimed(&series, next[i]);
+			else
+				pace_record_point(&series, end_ms[i], next[i]);
+		}
+		bench_pause();
+		points += BENCH_PACE_POINTS;
+
+		memset(model, 0, sizeof(*model));
+		pace_series_init(&series);
+		for (i = 0; i < BENCH_PACE_POINTS && !failed; i++) {
+			pace_event expected = PACE_EVENT_NONE;
+			pace_event event = PACE_EVENT_NONE;
+			int mean;
+
+			if (untimed[i]) {
+				pace_record_untimed(&series, next[i]);
+				_bench_pace_model_untimed(model, next[i]);
+			} else {
+				event = pace_record_point(&series, end_ms[i], next[i]);
+				expected = _bench_pace_model_point(model, end_ms[i], next[i]);
+			}
+			mean = model->changeovers ? (int)(model->changeover_total / model->changeovers) : -1;
+			slow += event != PACE_EVENT_NONE;
+
+			if (event != expected) {
+				bench_fail("pace", "match %d point %d raised %d, expected %d", m, i, event, expected);
+				failed = true;
+			} else if (series.points != model->points || series.count != (model->count < PACE_WINDOW ? model->count : PACE_WINDOW)) {
+				bench_fail("pace", "match %d point %d: %d points and %d intervals, expected %d and %d", m, i,
+						series.points, series.count, model->points, model->count);
+				failed = true;
+			} else if (pace_median_point_interval(&series) != _bench_pace_model_median(model)) {
+				bench_fail("pace", "match %d point %d: median %d, expected %d", m, i,
+						pace_median_point_interval(&series), _bench_pace_model_median(model));
+				failed = true;
+			} else if (pace_mean_changeover(&series) != mean) {
+				bench_fail("pace", "match %d point %d: mean changeover %d, expected %d", m, i, pace_mean_changeover(&series), mean);
+				failed = true;
+			} else if (!_bench_pace_check_export(&series, model)) {
+				bench_fail("pace", "match %d point %d: the export does not decode to the window", m, i);
+				failed = true;
+			}
+		}
+
+		if (failed)
+			break;
+	}
+
+	bench_end(&sample);
+	bench_report("pace", "long_match", &sample, points, "\"matches\":%d,\"points_per_match\":%d,\"slow_intervals\":%lld",
+			m, BENCH_PACE_POINTS, slow);
+
+out:
+	free(model);
+	free(next);
+	free(end_ms);
+	free(untimed);
+}
+
+/*
+ * @brief Cost per point of the pace of play, and checks of its window,
+ * median, slow rules and export against a plain model.
+ */
+void bench_pace(void)
+{
+	_bench_pace_edges();
+	_bench_pace_matches();
+}
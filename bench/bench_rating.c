@@ -0,0 +1,250 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "data.h"
+#include "match_registry.h"
+#include "rating.h"
+
+#define BENCH_RATING_PLAYERS 20000
+#define BENCH_RATING_QUICK_PLAYERS 500
+#define BENCH_RATING_MATCHES_PER_PLAYER 20
+/* Periods the history is spread over, about as long as RD needs to grow back */
+#define BENCH_RATING_PERIODS 100
+
+static button_score bench_button = {
+	.button = NULL,
+	.button_type = KEY_TYPE_ME,
+	.button_name = "bench",
+};
+
+/*
+ * @brief Plays random matches between players of hidden strengths.
+ * @param[in] unique_periods Give every match a period of its own
+ */
+static struct rating_result *_bench_rating_history(const double *strength, int players, int count, bool unique_periods)
+{
+	struct rating_result *results = malloc(count * sizeof(*results));
+	int i;
+
+	if (results == NULL)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		string_id a = 1 + bench_random() % players;
+		string_id b = 1 + (a + bench_random() % (players - 1)) % players;
+		double p_a = 1.0 / (1.0 + pow(10.0, (strength[b] - strength[a]) / 400.0));
+		bool a_wins = bench_random() < p_a * 4294967296.0;
+
+		results[i].winner = a_wins ? a : b;
+		results[i].loser = a_wins ? b : a;
+		results[i].period = unique_periods ? (unsigned int)i : (unsigned int)((long long)i * BENCH_RATING_PERIODS / count);
+		results[i].sets_winner = SET_MATCH;
+		results[i].sets_loser = bench_random() % SET_MATCH;
+		results[i].games_winner = 6 * SET_MATCH;
+		results[i].games_loser = bench_random() % (6 * SET_MATCH);
+	}
+
+	return results;
+}
+
+/*
+ * @brief Checks that two engines hold the same ratings for every player.
+ */
+static bool _bench_rating_same(const struct rating_engine *a, const struct rating_engine *b, int players)
+{
+	struct rating_player pa;
+	struct rating_player pb;
+	string_id id;
+
+	for (id = 1; id <= (string_id)players; id++) {
+		bool has_a = rating_engine_get(a, id, &pa);
+		bool has_b = rating_engine_get(b, id, &pb);
+
+		if (has_a != has_b || (has_a && memcmp(&pa, &pb, sizeof(pa))))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * @brief Fraction of the pairs of rated players the ratings order like their strengths.
+ */
+static double _bench_rating_concordance(const struct rating_engine *engine, const double *strength, int players, int samples)
+{
+	struct rating_player pa;
+	struct rating_player pb;
+	int agree = 0;
+	int pairs = 0;
+	int i;
+
+	for (i = 0; i < samples; i++) {
+		string_id a = 1 + bench_random() % players;
+		string_id b = 1 + bench_random() % players;
+
+		if (strength[a] == strength[b] || !rating_engine_get(engine, a, &pa) || !rating_engine_get(engine, b, &pb))
+			continue;
+
+		agree += (pa.rating > pb.rating) == (strength[a] > strength[b]);
+		pairs++;
+	}
+
+	return pairs ? (double)agree / pairs : 0.0;
+}
+
+/*
+ * @brief Scores a record that goes on after the match is won, it must be rated once.
+ */
+static void _bench_rating_data_once(void)
+{
+	struct rating_player player = { 0, };
+	struct match *match;
+	int i;
+
+	if (!data_initialize()) {
+		bench_fail("rating", "data_initialize failed");
+		return;
+	}
+
+	data_set_active_match(data_add_match(DATA_MY_NAME, DATA_OP_NAME));
+	match = match_registry_get(data_get_registry(), data_get_active_match());
+
+	/* Two love matches in a row in the same record */
+	for (i = 0; i < 2 * SET_MATCH * 6 * 4; i++)
+		data_add_my_score(&bench_button);
+
+	if (!match->finished || !rating_engine_get(data_get_ratings(), match->my_name, &player) || player.matches != 1)
+		bench_fail("rating", "a record played on after the win was rated %u times", player.matches);
+
+	data_finalize();
+	bench_report("rating", "rated_once", NULL, 1, NULL);
+}
+
+/*
+ * @brief Wins a love match against each of two named opponents. Each one
+ * must get a rating of their own, and the player scoring both a rating
+ * from both matches.
+ */
+static void _bench_rating_data_opponents(void)
+{
+	static const char *opponents[] = { "first opponent", "second opponent" };
+	struct rating_player player = { 0, };
+	struct match *match = NULL;
+	unsigned int i, p;
+
+	if (!data_initialize()) {
+		bench_fail("rating", "data_initialize failed");
+		return;
+	}
+
+	for (i = 0; i < sizeof(opponents) / sizeof(opponents[0]); i++) {
+		/* The first match is the one data_initialize() created, named before its first point */
+		if (!data_set_player_names("bench player", opponents[i]) ||
+				(i > 0 && !data_set_active_match(data_add_match(NULL, NULL)))) {
+			bench_fail("rating", "a match could not be named");
+			goto out;
+		}
+		match = match_registry_get(data_get_registry(), data_get_active_match());
+		if (strcmp(match_registry_string(data_get_registry(), match->op_name), opponents[i])) {
+			bench_fail("rating", "match %u is not against %s", i, opponents[i]);
+			goto out;
+		}
+
+		for (p = 0; p < SET_MATCH * 6 * 4; p++)
+			data_add_my_score(&bench_button);
+
+		if (!rating_engine_get(data_get_ratings(), match->op_name, &player) || player.matches != 1) {
+			bench_fail("rating", "%s was rated for %u matches", opponents[i], player.matches);
+			goto out;
+		}
+	}
+
+	if (!rating_engine_get(data_get_ratings(), match->my_name, &player) || player.matches != 2)
+		bench_fail("rating", "the player of both matches was rated for %u matches", player.matches);
+
+	bench_report("rating", "opponents", NULL, 2, NULL);
+
+out:
+	data_finalize();
+}
+
+/*
+ * @brief Rates a random history one result at a time and in a batch re-rate.
+ * With one period per match the re-rate must reproduce the incremental
+ * ratings exactly. With shared periods it is timed and must order the
+ * players at least as well as the incremental ratings.
+ */
+void bench_rating(void)
+{
+	int players = bench_quick() ? BENCH_RATING_QUICK_PLAYERS : BENCH_RATING_PLAYERS;
+	int count = players * BENCH_RATING_MATCHES_PER_PLAYER / 2;
+	struct rating_engine *incremental = rating_engine_create(true);
+	struct rating_engine *batch = rating_engine_create(true);
+	struct rating_result *results = NULL;
+	struct bench_sample sample;
+	double *strength = NULL;
+	double concordance;
+	int i;
+
+	_bench_rating_data_once();
+	_bench_rating_data_opponents();
+
+	strength = malloc((players + 1) * sizeof(*strength));
+	if (incremental == NULL || batch == NULL || strength == NULL) {
+		bench_fail("rating", "out of memory");
+		goto out;
+	}
+
+	for (i = 0; i <= players; i++)
+		strength[i] = 1000.0 + 1000.0 * bench_random() / 4294967296.0;
+
+	results = _bench_rating_history(strength, players, count, true);
+	if (results == NULL) {
+		bench_fail("rating", "out of memory");
+		goto out;
+	}
+
+	bench_begin();
+	for (i = 0; i < count; i++)
+		rating_engine_add_result(incremental, &results[i]);
+	bench_end(&sample);
+	concordance = _bench_rating_concordance(incremental, strength, players, 100000);
+	bench_report("rating", "incremental", &sample, count, "\"players\":%d,\"concordance\":%.3f", players, concordance);
+
+	rating_engine_import(batch, results, count);
+	rating_engine_rerate(batch);
+	if (!_bench_rating_same(incremental, batch, players))
+		bench_fail("rating", "re-rate differs from the incremental ratings with one match per period");
+	free(results);
+
+	/* The same kind of history, a month of matches per period */
+	results = _bench_rating_history(strength, players, count, false);
+	if (results == NULL) {
+		bench_fail("rating", "out of memory");
+		goto out;
+	}
+
+	rating_engine_destroy(batch);
+	batch = rating_engine_create(true);
+	if (batch == NULL || !rating_engine_import(batch, results, count)) {
+		bench_fail("rating", "out of memory");
+		goto out;
+	}
+
+	bench_begin();
+	rating_engine_rerate(batch);
+	bench_end(&sample);
+
+	if (_bench_rating_concordance(batch, strength, players, 100000) < concordance - 0.01)
+		bench_fail("rating", "re-rate with shared periods orders the players worse than the incremental ratings");
+	bench_report("rating", "rerate", &sample, count, "\"players\":%d,\"periods\":%d,\"concordance\":%.3f",
+			players, BENCH_RATING_PERIODS, _bench_rating_concordance(batch, strength, players, 100000));
+
+out:
+	free(results);
+	free(strength);
+	rating_engine_destroy(incremental);
+	rating_engine_destroy(batch);
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "match_registry.h"
+
+#define BENCH_REGISTRY_MATCHES 2000000
+#define BENCH_REGISTRY_QUICK_MATCHES 20000
+/* Matches kept live at once, the oldest one is retired for every new one */
+#define BENCH_REGISTRY_WINDOW 256
+#define BENCH_REGISTRY_POINTS_MAX 64
+/* One name in this many is too long for a pool slot */
+#define BENCH_REGISTRY_LONG_NAME_EVERY 97
+#define BENCH_REGISTRY_NAME_MAX 512
+
+/*
+ * @brief Writes the name of the n-th player, every player has a name of its own.
+ */
+static void _bench_registry_name(char *name, unsigned int n)
+{
+	int len = snprintf(name, BENCH_REGISTRY_NAME_MAX, "player %u", n);
+
+	if (n % BENCH_REGISTRY_LONG_NAME_EVERY == 0) {
+		memset(name + len, '.', 300);
+		name[len + 300] = '\0';
+	}
+}
+
+/*
+ * @brief Checks that a live match still resolves to the names it was created with.
+ */
+static bool _bench_registry_check_names(const struct match_registry *registry, match_handle handle, unsigned int n)
+{
+	struct match *match = match_registry_get(registry, handle);
+	char name[BENCH_REGISTRY_NAME_MAX];
+	const char *str;
+
+	if (match == NULL)
+		return false;
+
+	_bench_registry_name(name, 2 * n);
+	str = match_registry_string(registry, match->my_name);
+	if (str == NULL || strcmp(str, name))
+		return false;
+
+	_bench_registry_name(name, 2 * n + 1);
+	str = match_registry_string(registry, match->op_name);
+
+	return str && !strcmp(str, name);
+}
+
+/*
+ * @brief Adds matches whose names cannot be interned. The add must fail and
+ * leave no name behind, whichever of the two names failed.
+ */
+static void _bench_registry_failed_add(void)
+{
+	struct match_registry *registry = match_registry_create();
+	struct match_registry_stats stats;
+	char long_name[BENCH_REGISTRY_NAME_MAX];
+	bool failed = true;
+
+	if (registry == NULL) {
+		bench_fail("registry", "match_registry_create failed");
+		return;
+	}
+
+	/* Names too long for a slot get an allocation of their own, which is made to fail */
+	_bench_registry_name(long_name, 0);
+	if (match_registry_add(registry, "me", "op") == MATCH_HANDLE_INVALID) {
+		bench_fail("registry", "match_registry_add failed");
+		goto out;
+	}
+
+	bench_allocs_fail_next();
+	failed = match_registry_add(registry, long_name, "someone") == MATCH_HANDLE_INVALID;
+	bench_allocs_fail_next();
+	failed = failed && match_registry_add(registry, "someone else", long_name) == MATCH_HANDLE_INVALID;
+
+	match_registry_get_stats(registry, &stats);
+	if (!failed || stats.live != 1 || stats.strings != 2)
+		bench_fail("registry", "failed adds left %d matches and %d names", stats.live, stats.strings);
+
+	bench_report("registry", "failed_add", NULL, 2, "\"live\":%d,\"strings\":%d", stats.live, stats.strings);
+
+out:
+	match_registry_destroy(registry);
+}
+
+/*
+ * @brief Churn of matches between players that never meet again.
+ * Every match gets two new names and a few points and is retired a window
+ * later. Once the registry is warm, the only allocations left are the copies
+ * of the names too long for a pool slot, the strings it interns may not keep
+ * growing, and every live match must still resolve to its own names after
+ * their ids have been reused.
+ */
+static void _bench_registry_churn(void)
+{
+	match_handle window[BENCH_REGISTRY_WINDOW] = { MATCH_HANDLE_INVALID, };
+	char my_name[BENCH_REGISTRY_NAME_MAX];
+	char op_name[BENCH_REGISTRY_NAME_MAX];
+	unsigned int matches = bench_quick() ? BENCH_REGISTRY_QUICK_MATCHES : BENCH_REGISTRY_MATCHES;
+	struct match_registry_stats warm = { 0, };
+	struct bench_allocs allocs_start;
+	struct bench_allocs allocs_warm = { 0 };
+	struct bench_allocs allocs;
+	long long long_names = 0;
+	struct match_registry_stats stats;
+	struct match_registry *registry;
+	struct bench_sample sample;
+	long rss_start = bench_rss_kb();
+	long rss_warm = -1;
+	long long points = 0;
+	unsigned int n;
+	int i;
+
+	bench_allocs(&allocs_start);
+	registry = match_registry_create();
+	if (registry == NULL) {
+		bench_fail("registry", "match_registry_create failed");
+		return;
+	}
+
+	bench_begin();
+	for (n = 0; n < matches; n++) {
+		unsigned int slot = n % BENCH_REGISTRY_WINDOW;
+		struct match *match;
+		int count;
+
+		if (n >= BENCH_REGISTRY_WINDOW) {
+			if (!_bench_registry_check_names(registry, window[slot], n - BENCH_REGISTRY_WINDOW)) {
+				bench_fail("registry", "match %u lost its names", n - BENCH_REGISTRY_WINDOW);
+				break;
+			}
+			match_registry_retire(registry, window[slot]);
+		}
+
+		/* Snapshot once every slot and name id has been used, the rest must not grow */
+		if (n == 4 * BENCH_REGISTRY_WINDOW) {
+			bench_pause();
+			match_registry_get_stats(registry, &warm);
+			bench_allocs(&allocs_warm);
+			rss_warm = bench_rss_kb();
+			bench_resume();
+		}
+
+		_bench_registry_name(my_name, 2 * n);
+		_bench_registry_name(op_name, 2 * n + 1);
+		if (warm.created) {
+			long_names += (2 * n) % BENCH_REGISTRY_LONG_NAME_EVERY == 0;
+			long_names += (2 * n + 1) % BENCH_REGISTRY_LONG_NAME_EVERY == 0;
+		}
+		window[slot] = match_registry_add(registry, my_name, op_name);
+		match = match_registry_get(registry, window[slot]);
+		if (match == NULL) {
+			bench_fail("registry", "match_registry_add failed");
+			break;
+		}
+
+		count = 1 + bench_random() % BENCH_REGISTRY_POINTS_MAX;
+		for (i = 0; i < count; i++)
+			point_log_append(&match->log, bench_random() & 1);
+		points += count;
+	}
+	bench_end(&sample);
+	bench_allocs(&allocs);
+
+	match_registry_get_stats(registry, &stats);
+	if (stats.strings != 2 * stats.live)
+		bench_fail("registry", "%d names interned for %d live matches", stats.strings, stats.live);
+	if (warm.created && allocs.calls - allocs_warm.calls != long_names)
+		bench_fail("registry", "%lld allocations after warm-up for %lld long names",
+				allocs.calls - allocs_warm.calls, long_names);
+
+	bench_report("registry", "churn", &sample, n,
+			"\"points\":%lld,\"live\":%d,\"strings\":%d,\"slots\":%d,"
+			"\"allocations_warm\":%lld,\"allocations_after_warm\":%lld,\"long_names_after_warm\":%lld,"
+			"\"rss_start_kb\":%ld,\"rss_warm_kb\":%ld,\"rss_end_kb\":%ld,\"peak_rss_kb\":%ld",
+			points, stats.live, stats.strings, stats.slots,
+			allocs_warm.calls - allocs_start.calls, allocs.calls - allocs_warm.calls, long_names,
+			rss_start, rss_warm, bench_rss_kb(), bench_peak_rss_kb());
+
+	for (i = 0; i < BENCH_REGISTRY_WINDOW && (unsigned int)i < matches; i++)
+		match_registry_retire(registry, window[i]);
+
+	match_registry_get_stats(registry, &stats);
+	if (stats.live != 0 || stats.strings != 0)
+		bench_fail("registry", "%d names still interned after every match was retired", stats.strings);
+
+	match_registry_destroy(registry);
+}
+
+/*
+ * @brief Allocations of a long-running registry and its error paths.
+ */
+void bench_registry(void)
+{
+	_bench_registry_churn();
+	_bench_registry_failed_add();
+}
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "data.h"
+#include "point_log.h"
+#include "match_registry.h"
+
+#define BENCH_SCORE_MATCHES 20000
+#define BENCH_SCORE_QUICK_MATCHES 200
+#define BENCH_SCORE_POINTS_MAX 1000
+
+/*
+ * Ways of scoring a point that must all agree with the reference rules.
+ */
+typedef enum {
+	BENCH_SCORE_REFERENCE = 0,
+	BENCH_SCORE_POINT_LOG = 1,
+	BENCH_SCORE_DATA_ADD = 2,
+	BENCH_SCORE_VARIANTS = 3,
+} bench_score_variant;
+
+static const char *variant_names[BENCH_SCORE_VARIANTS] = {
+	"reference",
+	"point_log",
+	"data_add",
+};
+
+static button_score bench_button = {
+	.button = NULL,
+	.button_type = KEY_TYPE_ME,
+	.button_name = "bench",
+};
+
+/*
+ * @brief Draws random matches, each played until the reference rules end it.
+ */
+static void _bench_score_generate(struct bench_sequences *seq, int matches)
+{
+	int capacity = matches * 200;
+	int m;
+
+	seq->points = malloc(capacity);
+	seq->start = malloc((matches + 1) * sizeof(*seq->start));
+	seq->count = matches;
+	seq->total = 0;
+
+	for (m = 0; m < matches; m++) {
+		struct match_score score = { { 0, }, { 0, } };
+		double p_me = 0.3 + 0.4 * bench_random() / 4294967296.0;
+		int n;
+
+		seq->start[m] = seq->total;
+		for (n = 0; n < BENCH_SCORE_POINTS_MAX; n++) {
+			key_type winner = bench_random_point(p_me);
+			bool won;
+
+			if (seq->total == capacity) {
+				capacity *= 2;
+				seq->points = realloc(seq->points, capacity);
+			}
+			seq->points[seq->total++] = winner;
+
+			won = winner == KEY_TYPE_ME ? data_score_add_point(&score.my) : data_score_add_point(&score.op);
+			if (won)
+				break;
+		}
+	}
+	seq->start[matches] = seq->total;
+}
+
+/*
+ * @brief Starts a new match in the data layer and retires the previous one.
+ */
+static void _bench_score_next_match(void)
+{
+	match_handle previous = data_get_active_match();
+
+	data_set_active_match(data_add_match(DATA_MY_NAME, DATA_OP_NAME));
+	data_retire_match(previous);
+}
+
+/*
+ * @brief Scores a point through the application entry points.
+ */
+static void _bench_score_data_add(key_type winner)
+{
+	if (winner == KEY_TYPE_ME)
+		data_add_my_score(&bench_button);
+	else
+		data_add_opponent_score(&bench_button);
+}
+
+/*
+ * @brief Scores every sequence with every variant and compares them after each point.
+ * @return Number of points where a variant disagreed with the reference
+ */
+static int _bench_score_check(const char *name, const struct bench_sequences *seq)
+{
+	struct point_log log;
+	int mismatches = 0;
+	int m, i;
+
+	point_log_init(&log, 1);
+
+	for (m = 0; m < seq->count; m++) {
+		struct match_score reference = { { 0, }, { 0, } };
+
+		point_log_reset(&log);
+		_bench_score_next_match();
+
+		for (i = seq->start[m]; i < seq->start[m + 1]; i++) {
+			struct match_score cached;
+			struct match_score active;
+			key_type winner = seq->points[i];
+
+			data_match_score_add_point(&reference, winner);
+			point_log_append(&log, winner);
+			_bench_score_data_add(winner);
+
+			point_log_get_score(&log, &cached);
+			active.my = *data_get_my_score();
+			active.op = *data_get_opponent_score();
+
+			if (memcmp(&cached, &reference, sizeof(reference))) {
+				if (mismatches++ == 0)
+					bench_fail("score", "%s: point_log differs from the reference at match %d point %d", name, m, i - seq->start[m]);
+			}
+			if (memcmp(&active, &reference, sizeof(reference))) {
+				if (mismatches++ == 0)
+					bench_fail("score", "%s: data_add differs from the reference at match %d point %d", name, m, i - seq->start[m]);
+			}
+		}
+	}
+
+	point_log_fini(&log);
+
+	return mismatches;
+}
+
+/*
+ * @brief Times one variant over every sequence.
+ */
+static void _bench_score_time(const char *name, const struct bench_sequences *seq, bench_score_variant variant, int mismatches)
+{
+	struct bench_sample sample;
+	struct point_log log;
+	char case_name[64];
+	unsigned int sink = 0;
+	int m, i;
+
+	point_log_init(&log, 1);
+
+	bench_begin();
+	for (m = 0; m < seq->count; m++) {
+		struct match_score score = { { 0, }, { 0, } };
+
+		switch (variant) {
+		case BENCH_SCORE_REFERENCE:
+			for (i = seq->start[m]; i < seq->start[m + 1]; i++)
+				data_match_score_add_point(&score, seq->points[i]);
+			sink += score.my.set_won + score.op.set_won;
+			break;
+		case BENCH_SCORE_POINT_LOG:
+			point_log_reset(&log);
+			for (i = seq->start[m]; i < seq->start[m + 1]; i++)
+				point_log_append(&log, seq->points[i]);
+			sink += log.count;
+			break;
+		case BENCH_SCORE_DATA_ADD:
+			_bench_score_next_match();
+			for (i = seq->start[m]; i < seq->start[m + 1]; i++)
+				_bench_score_data_add(seq->points[i]);
+			break;
+		default:
+			break;
+		}
+	}
+	bench_end(&sample);
+
+	point_log_fini(&log);
+
+	snprintf(case_name, sizeof(case_name), "%s/%s", name, variant_names[variant]);
+	bench_report("score", case_name, &sample, seq->total, "\"matches\":%d,\"mismatches\":%d,\"sink\":%u",
+			seq->count, mismatches, sink);
+}
+
+/*
+ * @brief Runs every variant over one set of sequences.
+ */
+static void _bench_score_run(const char *name, const struct bench_sequences *seq)
+{
+	int mismatches = _bench_score_check(name, seq);
+	int v;
+
+	for (v = 0; v < BENCH_SCORE_VARIANTS; v++)
+		_bench_score_time(name, seq, v, mismatches);
+}
+
+/*
+ * @brief Differential benchmark of the scoring path.
+ * Random matches, and the recorded ones given with -p, are scored by the
+ * reference rules, the point log and the data_add_* entry points. Every
+ * variant is compared with the reference after every point before any of
+ * them is timed.
+ */
+void bench_score(void)
+{
+	struct bench_sequences generated;
+
+	if (!data_initialize() || !data_compile_moments()) {
+		bench_fail("score", "data_initialize or data_compile_moments failed");
+		data_finalize();
+		return;
+	}
+
+	_bench_score_generate(&generated, bench_quick() ? BENCH_SCORE_QUICK_MATCHES : BENCH_SCORE_MATCHES);
+	_bench_score_run("random", &generated);
+	free(generated.points);
+	free(generated.start);
+
+	if (bench_recorded())
+		_bench_score_run("recorded", bench_recorded());
+
+	data_finalize();
+}
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "data.h"
+#include "point_log.h"
+#include "match_registry.h"
+#include "similarity.h"
+
+#define BENCH_SIMILARITY_MATCHES 1000000
+#define BENCH_SIMILARITY_QUICK_MATCHES 2000
+#define BENCH_SIMILARITY_QUERIES 200
+#define BENCH_SIMILARITY_QUICK_QUERIES 100
+#define BENCH_SIMILARITY_K 10
+#define BENCH_SIMILARITY_POINTS_MAX 1000
+#define BENCH_SIMILARITY_MIN_RECALL 0.99
+
+static button_score bench_button = {
+	.button = NULL,
+	.button_type = KEY_TYPE_ME,
+	.button_name = "bench",
+};
+
+/*
+ * @brief Scores a random match into a log.
+ */
+static void _bench_similarity_match(struct point_log *log)
+{
+	struct match_score score = { { 0, }, { 0, } };
+	double p_me = 0.3 + 0.4 * bench_random() / 4294967296.0;
+	int n;
+
+	point_log_reset(log);
+	for (n = 0; n < BENCH_SIMILARITY_POINTS_MAX; n++) {
+		key_type winner = bench_random_point(p_me);
+
+		point_log_append(log, winner);
+		if (winner == KEY_TYPE_ME ? data_score_add_point(&score.my) : data_score_add_point(&score.op))
+			break;
+	}
+}
+
+/*
+ * @brief Exact top k by cosine similarity over the live items.
+ * @return Score of the k-th best match
+ */
+static float _bench_similarity_brute(const struct similarity_fingerprint *fps, const bool *live, int count, int query)
+{
+	float best[BENCH_SIMILARITY_K];
+	int found = 0;
+	int i, d;
+
+	for (i = 0; i < count; i++) {
+		float score;
+		int dot = 0;
+		int pos;
+
+		if (i == query || !live[i])
+			continue;
+
+		for (d = 0; d < SIMILARITY_DIMS; d++)
+			dot += fps[i].v[d] * fps[query].v[d];
+		score = (float)dot / (127 * 127);
+
+		if (found == BENCH_SIMILARITY_K && score <= best[BENCH_SIMILARITY_K - 1])
+			continue;
+
+		pos = found < BENCH_SIMILARITY_K ? found++ : BENCH_SIMILARITY_K - 1;
+		while (pos > 0 && best[pos - 1] < score) {
+			best[pos] = best[pos - 1];
+			pos--;
+		}
+		best[pos] = score;
+	}
+
+	return found ? best[found - 1] : -1.0f;
+}
+
+/*
+ * @brief Queries the index and compares it with an exhaustive search.
+ * A result counts towards recall when it scores at least as well as the
+ * k-th exact match, so ties do not depend on the order of the scan.
+ */
+static void _bench_similarity_queries(struct similarity_index *index, const struct similarity_fingerprint *fps, const bool *live,
+		int count, const char *name)
+{
+	match_handle handles[BENCH_SIMILARITY_K];
+	float scores[BENCH_SIMILARITY_K];
+	int queries = bench_quick() ? BENCH_SIMILARITY_QUICK_QUERIES : BENCH_SIMILARITY_QUERIES;
+	struct bench_sample sample;
+	long long hits = 0;
+	long long wanted = 0;
+	int q, i;
+
+	bench_begin();
+	bench_pause();
+
+	for (q = 0; q < queries; q++) {
+		int query;
+		int found;
+		float kth;
+
+		do {
+			query = bench_random() % count;
+		} while (!live[query]);
+
+		bench_resume();
+		found = similarity_index_query(index, &fps[query], query + 1, BENCH_SIMILARITY_K, handles, scores);
+		bench_pause();
+
+		kth = _bench_similarity_brute(fps, live, count, query);
+		for (i = 0; i < found; i++) {
+			int item = (int)handles[i] - 1;
+
+			if (item == query || !live[item]) {
+				bench_fail("similarity", "%s: query %d returned %s match %d", name, query,
+						item == query ? "the excluded" : "a removed", item);
+				continue;
+			}
+			hits += scores[i] >= kth - 1e-6f;
+		}
+		wanted += BENCH_SIMILARITY_K;
+	}
+
+	bench_end(&sample);
+
+	if ((double)hits / wanted < BENCH_SIMILARITY_MIN_RECALL)
+		bench_fail("similarity", "%s: recall@%d of %.3f", name, BENCH_SIMILARITY_K, (double)hits / wanted);
+
+	bench_report("similarity", name, &sample, queries, "\"indexed\":%d,\"recall_at_%d\":%.4f",
+			similarity_index_count(index), BENCH_SIMILARITY_K, (double)hits / wanted);
+}
+
+/*
+ * @brief Scores the points of a log into the active match.
+ */
+static void _bench_similarity_replay(const struct point_log *log)
+{
+	int i;
+
+	for (i = 0; i < log->count; i++) {
+		if (log->ops[i].winner == KEY_TYPE_ME)
+			data_add_my_score(&bench_button);
+		else
+			data_add_opponent_score(&bench_button);
+	}
+}
+
+/*
+ * @brief A record that goes on after the win must fingerprint like the match
+ * alone, and be indexed once.
+ */
+static void _bench_similarity_data(void)
+{
+	struct similarity_fingerprint alone;
+	struct similarity_fingerprint played_on;
+	struct point_log log;
+	match_handle handles[2];
+	float scores[2];
+	match_handle first;
+	match_handle second;
+	int i;
+
+	point_log_init(&log, 1);
+	_bench_similarity_match(&log);
+	similarity_fingerprint_compute(&log, &alone);
+	for (i = 0; i < 40; i++)
+		point_log_append(&log, bench_random_point(0.5));
+	similarity_fingerprint_compute(&log, &played_on);
+	if (memcmp(&alone, &played_on, sizeof(alone)))
+		bench_fail("similarity", "points after the win changed the fingerprint");
+
+	if (!data_initialize()) {
+		bench_fail("similarity", "data_initialize failed");
+		point_log_fini(&log);
+		return;
+	}
+
+	/* The same match in two records, the first one played on to a second win */
+	first = data_add_match(DATA_MY_NAME, DATA_OP_NAME);
+	second = data_add_match(DATA_MY_NAME, DATA_OP_NAME);
+	data_set_active_match(first);
+	_bench_similarity_replay(&log);
+	for (i = 0; i < 2 * SET_MATCH * 6 * 4; i++)
+		data_add_my_score(&bench_button);
+	data_set_active_match(second);
+	_bench_similarity_replay(&log);
+
+	/* Both records are indexed once, and the second one is left out of its own query */
+	if (data_find_similar_matches(second, 2, handles, scores) != 1 || handles[0] != first)
+		bench_fail("similarity", "a record played on after the win was indexed more than once");
+
+	data_retire_match(first);
+	if (data_find_similar_matches(second, 2, handles, scores) != 0)
+		bench_fail("similarity", "a retired match is still offered as similar");
+
+	data_finalize();
+	point_log_fini(&log);
+
+	bench_report("similarity", "data", NULL, 1, NULL);
+}
+
+/*
+ * @brief Recall and latency of the similarity index against an exhaustive
+ * search, before and after half of the matches are removed, and after new
+ * matches take the removed items.
+ */
+void bench_similarity(void)
+{
+	int count = bench_quick() ? BENCH_SIMILARITY_QUICK_MATCHES : BENCH_SIMILARITY_MATCHES;
+	struct similarity_fingerprint *fps = malloc(count * sizeof(*fps));
+	struct similarity_index *index = similarity_index_create();
+	bool *live = calloc(count, sizeof(*live));
+	int *items = malloc(count * sizeof(*items));
+	struct bench_sample sample;
+	struct point_log log;
+	int i;
+
+	_bench_similarity_data();
+
+	if (fps == NULL || index == NULL || live == NULL || items == NULL) {
+		bench_fail("similarity", "out of memory");
+		goto out;
+	}
+
+	point_log_init(&log, 1);
+	for (i = 0; i < count; i++) {
+		_bench_similarity_match(&log);
+		similarity_fingerprint_compute(&log, &fps[i]);
+	}
+	point_log_fini(&log);
+
+	/* Handles are item + 1, so 0 stays invalid */
+	bench_begin();
+	for (i = 0; i < count; i++) {
+		items[i] = similarity_index_add(index, i + 1, &fps[i]);
+		live[i] = items[i] >= 0;
+	}
+	bench_end(&sample);
+	bench_report("similarity", "add", &sample, count, NULL);
+
+	_bench_similarity_queries(index, fps, live, count, "query");
+
+	bench_begin();
+	for (i = 0; i < count; i += 2) {
+		similarity_index_remove(index, items[i]);
+		live[i] = false;
+	}
+	bench_end(&sample);
+	bench_report("similarity", "remove", &sample, (count + 1) / 2, NULL);
+
+	if (similarity_index_count(index) != count / 2)
+		bench_fail("similarity", "%d matches indexed after removing half of %d", similarity_index_count(index), count);
+
+	_bench_similarity_queries(index, fps, live, count, "query_after_remove");
+
+	/* The removed matches come back in the removed items */
+	for (i = 0; i < count; i += 2) {
+		items[i] = similarity_index_add(index, i + 1, &fps[i]);
+		live[i] = items[i] >= 0;
+	}
+
+	if (similarity_index_count(index) != count)
+		bench_fail("similarity", "%d matches indexed after adding back to %d", similarity_index_count(index), count);
+
+	_bench_similarity_queries(index, fps, live, count, "query_after_reuse");
+
+out:
+	similarity_index_destroy(index);
+	free(fps);
+	free(live);
+	free(items);
+}
@@ -0,0 +1,117 @@
+#!/bin/sh
+# Launches the application on a connected device N times, cold and warm, and
+# prints the startup phases it logs as lines of JSON like the host benchmarks.
+#
+# Cold runs drop the page cache first, which needs "sdb root on". Warm runs
+# follow an unmeasured launch, so the binary and the theme are cached.
+#
+#     bench/launch.sh [-n runs] [-t timeout_s] [cold|warm]...
+
+APP_ID=com.matimoro.tennis.scores
+LOG_TAG=tennis-scores
+RUNS=10
+TIMEOUT=20
+SDB=${SDB:-sdb}
+
+usage() {
+	echo "usage: $0 [-n runs] [-t timeout_s] [cold|warm]..." >&2
+	exit 2
+}
+
+while getopts n:t:h opt; do
+	case $opt in
+	n) RUNS=$OPTARG ;;
+	t) TIMEOUT=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || set -- cold warm
+
+device() {
+	$SDB shell "$@" | tr -d '\r'
+}
+
+# Waits for the application to terminate, so the next launch starts a new process
+terminate() {
+	device app_launcher -t $APP_ID > /dev/null
+	i=0
+	while device app_launcher -r $APP_ID | grep -q "is running" && [ $i -lt 50 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+}
+
+# Launches once and prints the "startup:" lines of that launch
+launch() {
+	device dlogutil -c
+	device app_launcher -s $APP_ID > /dev/null
+
+	i=0
+	while [ $i -lt $((TIMEOUT * 10)) ]; do
+		lines=$(device dlogutil -d -v raw $LOG_TAG:I | grep "startup: phase=")
+		if echo "$lines" | grep -q "phase=ready"; then
+			echo "$lines"
+			return 0
+		fi
+		sleep 0.1
+		i=$((i + 1))
+	done
+
+	echo "$lines"
+	return 1
+}
+
+# Turns the "startup:" lines of one launch into a JSON result
+report() {
+	awk -v mode="$1" -v run="$2" -v ok="$3" '
+	{
+		for (f = 1; f <= NF; f++) {
+			split($f, kv, "=")
+			if (kv[1] == "phase") phase = kv[2]
+			else if (kv[1] == "ms") ms = kv[2]
+			else if (kv[1] == "total") total = kv[2]
+		}
+		phases = phases (n++ ? "," : "") "\"" phase "\":" ms
+		if (phase == "exec") exec_ms = ms
+	}
+	END {
+		printf "{\"bench\":\"launch\",\"case\":\"%s\",\"run\":%d,\"complete\":%s,", mode, run, ok ? "true" : "false"
+		printf "\"exec_ms\":%s,\"ready_ms\":%s,\"phases_ms\":{%s}}\n", exec_ms == "" ? "null" : exec_ms, total == "" ? "null" : total, phases
+	}'
+}
+
+if ! $SDB get-state 2>/dev/null | grep -q device; then
+	echo "$0: no device connected" >&2
+	exit 1
+fi
+
+for mode in "$@"; do
+	case $mode in
+	cold) ;;
+	warm)
+		terminate
+		launch > /dev/null
+		;;
+	*) usage ;;
+	esac
+
+	run=1
+	while [ $run -le "$RUNS" ]; do
+		terminate
+		if [ "$mode" = cold ] && ! device "sync && echo 3 > /proc/sys/vm/drop_caches" > /dev/null 2>&1; then
+			echo "$0: dropping caches failed, run \"$SDB root on\"" >&2
+			exit 1
+		fi
+
+		if lines=$(launch); then
+			echo "$lines" | report "$mode" $run 1
+		else
+			echo "$0: no phase=ready within ${TIMEOUT}s" >&2
+			echo "$lines" | report "$mode" $run 0
+		fi
+		run=$((run + 1))
+	done
+done
+
+terminate
@@ -0,0 +1,4 @@
+#if !defined(_BENCH_STUB_APP_H)
+#define _BENCH_STUB_APP_H
+
+#endif
@@ -0,0 +1,6 @@
+#if !defined(_BENCH_STUB_APP_COMMON_H)
+#define _BENCH_STUB_APP_COMMON_H
+
+char *app_get_resource_path(void);
+
+#endif
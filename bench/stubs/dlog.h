@@ -0,0 +1,18 @@
+#if !defined(_BENCH_STUB_DLOG_H)
+#define _BENCH_STUB_DLOG_H
+
+typedef enum {
+	DLOG_UNKNOWN = 0,
+	DLOG_DEFAULT,
+	DLOG_VERBOSE,
+	DLOG_DEBUG,
+	DLOG_INFO,
+	DLOG_WARN,
+	DLOG_ERROR,
+	DLOG_FATAL,
+	DLOG_SILENT,
+} log_priority;
+
+int dlog_print(log_priority prio, const char *tag, const char *fmt, ...);
+
+#endif
@@ -0,0 +1,4 @@
+#if !defined(_BENCH_STUB_EFL_EXTENSION_H)
+#define _BENCH_STUB_EFL_EXTENSION_H
+
+#endif
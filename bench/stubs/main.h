@@ -0,0 +1,21 @@
+#if !defined(_MAIN_H)
+#define _MAIN_H
+
+/*
+ * Host replacement for inc/main.h. It only declares what the engine
+ * sources use, so they build without the Tizen and EFL headers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <dlog.h>
+
+typedef struct _Evas_Object Evas_Object;
+typedef unsigned char Eina_Bool;
+
+#define LOG_TAG "tennis-scores"
+#define PACKAGE "com.matimoro.tennis.scores"
+
+#endif
@@ -0,0 +1,4 @@
+#if !defined(_BENCH_STUB_MEDIA_CONTENT_H)
+#define _BENCH_STUB_MEDIA_CONTENT_H
+
+#endif
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <dlog.h>
+#include <app_common.h>
+#include <system_info.h>
+#include "../bench.h"
+
+/*
+ * @brief Prints errors, and everything else with -v.
+ */
+int dlog_print(log_priority prio, const char *tag, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (prio < DLOG_ERROR && !bench_verbose())
+		return 0;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "%s: ", tag);
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+
+	return 0;
+}
+
+/*
+ * @brief The host has no resource directory.
+ */
+char *app_get_resource_path(void)
+{
+	return NULL;
+}
+
+/*
+ * @brief The host has no Tizen id, so the data layer picks a random device id.
+ */
+int system_info_get_platform_string(const char *key, char **value)
+{
+	*value = NULL;
+	return SYSTEM_INFO_ERROR_NOT_SUPPORTED;
+}
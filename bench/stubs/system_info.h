@@ -0,0 +1,11 @@
+#if !defined(_BENCH_STUB_SYSTEM_INFO_H)
+#define _BENCH_STUB_SYSTEM_INFO_H
+
+typedef enum {
+	SYSTEM_INFO_ERROR_NONE = 0,
+	SYSTEM_INFO_ERROR_NOT_SUPPORTED = -1,
+} system_info_error_e;
+
+int system_info_get_platform_string(const char *key, char **value);
+
+#endif
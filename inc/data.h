@@ -1,6 +1,9 @@
 #if !defined(_DATA_H)
 #define _DATA_H
 
+#define DATA_MY_NAME "me"
+#define DATA_OP_NAME "opponent"
+
 typedef enum {
 	POINT_LOVE = 0,
 	POINT_15 = 1,
@@ -37,16 +40,46 @@ struct score {
 	set set_won;
 };
 
+struct match_score {
+	struct score my;
+	struct score op;
+};
+
 typedef struct {
 	Evas_Object *button;
 	key_type button_type;
 	const char *button_name;
 } button_score;
 
+struct point_log;
+struct match_registry;
+struct rating_engine;
+
+/*
+ * Stable handle of a match in the registry, 0 is never a valid handle.
+ */
+typedef unsigned long long match_handle;
+
+bool data_initialize(void);
+void data_finalize(void);
+bool data_compile_moments(void);
+struct match_registry *data_get_registry(void);
+struct rating_engine *data_get_ratings(void);
+bool data_set_player_names(const char *my_name, const char *op_name);
+match_handle data_add_match(const char *my_name, const char *op_name);
+match_handle data_get_active_match(void);
+bool data_set_active_match(match_handle handle);
+bool data_retire_match(match_handle handle);
 struct score *data_get_my_score(void);
 struct score *data_get_opponent_score(void);
 void data_add_my_score(button_score *btn_score);
 void data_add_opponent_score(button_score *btn_score);
+bool data_score_add_point(struct score *score);
+void data_match_score_add_point(struct match_score *match, key_type winner);
+void data_set_device_id(unsigned int device_id);
+bool data_merge_point_log(const struct point_log *remote);
+const struct point_log *data_get_point_log(void);
+int data_find_similar_matches(match_handle handle, int k, match_handle *handles_out, float *scores_out);
 void data_get_resource_path(const char *file_in, char *file_path_out, int file_path_max);
 
 #endif
@@ -0,0 +1,22 @@
+#if !defined(_EXPORT_H)
+#define _EXPORT_H
+
+#include <main.h>
+
+/* Formatting workers of an export at most */
+#define EXPORT_THREADS_MAX 16
+
+typedef enum {
+	EXPORT_FORMAT_CSV = 0,
+	EXPORT_FORMAT_JSON = 1,
+} export_format;
+
+struct match_registry;
+struct export_snapshot;
+
+struct export_snapshot *export_snapshot_create(const struct match_registry *registry);
+void export_snapshot_destroy(struct export_snapshot *snapshot);
+bool export_snapshot_write(const struct export_snapshot *snapshot, int fd, export_format format, int threads);
+bool export_matches(const struct match_registry *registry, int fd, export_format format, int threads);
+
+#endif
@@ -0,0 +1,66 @@
+#if !defined(_MATCH_REGISTRY_H)
+#define _MATCH_REGISTRY_H
+
+#include <main.h>
+#include "data.h"
+#include "point_log.h"
+#include "string_pool.h"
+#include "moment.h"
+#include "pace.h"
+#include "rating.h"
+
+struct match_registry;
+
+/*
+ * The low 32 bits of a match_handle index the slot and the high 32 bits
+ * hold the slot generation, so handles of retired matches never resolve
+ * to the match that reused their slot.
+ */
+#define MATCH_HANDLE_INVALID 0ULL
+
+struct match {
+	struct match_score score;
+	struct point_log log;
+	struct moment_stream moments;
+	struct moment_history moment_checkpoints;
+	struct pace_series pace;
+	string_id my_name;
+	string_id op_name;
+	unsigned int generation;
+	int next_free;
+	bool live;
+	/* Set once the match has been won, points scored after that do not count */
+	bool finished;
+	/* Number of points up to the one that won the match, once it is finished */
+	int win_points;
+	/* Result the players were rated on, a winner of 0 if they were not */
+	struct rating_result result;
+	/* Item of the match in the similarity index, -1 if it is not indexed */
+	int similar_item;
+};
+
+struct match_registry_stats {
+	int live;
+	int slots;
+	int slabs;
+	long long created;
+	long long retired;
+	int strings;
+};
+
+typedef void (*match_registry_foreach_cb)(match_handle handle, struct match *match, void *user_data);
+
+struct match_registry *match_registry_create(void);
+void match_registry_destroy(struct match_registry *registry);
+match_handle match_registry_add(struct match_registry *registry, const char *my_name, const char *op_name);
+bool match_registry_rename(struct match_registry *registry, match_handle handle, const char *my_name, const char *op_name);
+struct match *match_registry_get(const struct match_registry *registry, match_handle handle);
+bool match_registry_retire(struct match_registry *registry, match_handle handle);
+void match_registry_foreach(const struct match_registry *registry, match_registry_foreach_cb cb, void *user_data);
+string_id match_registry_intern(struct match_registry *registry, const char *str);
+void match_registry_retain_name(struct match_registry *registry, string_id id);
+void match_registry_release_name(struct match_registry *registry, string_id id);
+const char *match_registry_string(const struct match_registry *registry, string_id id);
+void match_registry_get_stats(const struct match_registry *registry, struct match_registry_stats *stats_out);
+
+#endif
@@ -0,0 +1,77 @@
+#if !defined(_MOMENT_H)
+#define _MOMENT_H
+
+#include <main.h>
+#include "data.h"
+
+#define MOMENT_RULES_MAX 32
+#define MOMENT_CHECKPOINT_POINTS 32
+
+/*
+ * Key moments are described by rules, one per line:
+ *
+ *     name: term term ...
+ *
+ * Each term is a predicate optionally followed by a quantifier '{n}', '*',
+ * '+' or '?'. A predicate is '.' (any point) or atoms joined by '&', with
+ * '|' between alternatives and '!' negating an atom. A rule fires after
+ * every point that ends a sequence of points matching its terms.
+ *
+ * Atoms describing the point just played:
+ *     me, op, game_me, game_op, set_me, set_op, match_me, match_op
+ * Atoms describing the situation for the next point:
+ *     srv_me, srv_op, gp_me, gp_op, bp_me, bp_op, sp_me, sp_op, mp_me, mp_op,
+ *     sfs_me, sfs_op (serving for the set), trail_me, trail_op,
+ *     trail2_me, trail2_op (two games or a set behind), level
+ *
+ * The server is not scored, so 'me' is assumed to serve the first game.
+ */
+#define MOMENT_DEFAULT_RULES \
+	"break_point_me: bp_me\n" \
+	"break_point_op: bp_op\n" \
+	"set_point_me: sp_me&!mp_me\n" \
+	"set_point_op: sp_op&!mp_op\n" \
+	"match_point_me: mp_me\n" \
+	"match_point_op: mp_op\n" \
+	"serving_for_set_me: game_me&sfs_me|game_op&sfs_me\n" \
+	"serving_for_set_op: game_me&sfs_op|game_op&sfs_op\n" \
+	"comeback_me: trail2_me !level* level&game_me\n" \
+	"comeback_op: trail2_op !level* level&game_op\n" \
+	"momentum_me: me{6}\n" \
+	"momentum_op: op{6}\n"
+
+struct moment_rules;
+
+/*
+ * Per-match state of the detector: one automaton state per rule.
+ */
+struct moment_stream {
+	unsigned char state[MOMENT_RULES_MAX];
+	unsigned short games_played;
+};
+
+/*
+ * Detector states saved every MOMENT_CHECKPOINT_POINTS points of a match:
+ * checkpoints[i] is the state after (i + 1) * MOMENT_CHECKPOINT_POINTS
+ * points. A merge that rescores the match from some point on resumes from
+ * the last checkpoint before it instead of the first point.
+ */
+struct moment_history {
+	struct moment_stream *checkpoints;
+	int count;
+	int capacity;
+};
+
+struct moment_rules *moment_rules_compile(const char *source);
+void moment_rules_destroy(struct moment_rules *rules);
+int moment_rules_count(const struct moment_rules *rules);
+const char *moment_rules_name(const struct moment_rules *rules, int index);
+void moment_stream_init(struct moment_stream *stream);
+unsigned int moment_stream_feed(const struct moment_rules *rules, struct moment_stream *stream, key_type winner, const struct match_score *after);
+void moment_history_init(struct moment_history *history);
+void moment_history_fini(struct moment_history *history);
+void moment_history_reset(struct moment_history *history);
+void moment_history_save(struct moment_history *history, const struct moment_stream *stream, int points);
+int moment_history_resume(struct moment_history *history, int point, struct moment_stream *stream_out);
+
+#endif
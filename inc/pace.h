@@ -0,0 +1,64 @@
+#if !defined(_PACE_H)
+#define _PACE_H
+
+#include <main.h>
+
+#define PACE_WINDOW 64
+#define PACE_BUCKETS 64
+#define PACE_SERVE_CLOCK_DS 250
+#define PACE_CHANGEOVER_LIMIT_DS 900
+#define PACE_SET_BREAK_LIMIT_DS 1200
+/*
+ * Only the end of a point is timestamped, so an interval runs from the end
+ * of one point to the end of the next and holds the next rally as well as
+ * the break before it. An interval is slow when it is longer than the limit
+ * of the break plus this allowance for a long rally. A slow interval is a
+ * likely time violation, not a measured one.
+ */
+#define PACE_RALLY_ALLOWANCE_DS 150
+
+typedef enum {
+	PACE_INTERVAL_POINT = 0,
+	PACE_INTERVAL_CHANGEOVER = 1,
+	PACE_INTERVAL_SET_BREAK = 2,
+} pace_interval;
+
+typedef enum {
+	PACE_EVENT_NONE = 0,
+	PACE_EVENT_SLOW_POINT = 1,
+	PACE_EVENT_SLOW_CHANGEOVER = 2,
+} pace_event;
+
+/*
+ * Pace of play of one match in about two hundred bytes. The last
+ * PACE_WINDOW intervals between the ends of points are kept in deciseconds
+ * with their pace_interval kind in the top two bits, and a histogram of one-second
+ * buckets over the point intervals in the window gives the rolling median
+ * without sorting.
+ */
+struct pace_series {
+	unsigned long long last_ms;
+	unsigned short interval[PACE_WINDOW];
+	unsigned char histogram[PACE_BUCKETS];
+	unsigned char head;
+	unsigned char count;
+	unsigned char point_count;
+	unsigned char next_kind;
+	/* The last point was scored on another device, so its end is unknown */
+	unsigned char untimed;
+	unsigned short points;
+	unsigned short slow_intervals;
+	unsigned short changeovers;
+	unsigned short last_changeover;
+	unsigned int changeover_total;
+};
+
+unsigned long long pace_now_ms(void);
+void pace_series_init(struct pace_series *series);
+pace_event pace_record_point(struct pace_series *series, unsigned long long now_ms, pace_interval next);
+void pace_record_untimed(struct pace_series *series, pace_interval next);
+int pace_median_point_interval(const struct pace_series *series);
+int pace_mean_changeover(const struct pace_series *series);
+int pace_export(const struct pace_series *series, unsigned char *buf, int size);
+
+#endif
@@ -0,0 +1,45 @@
+#if !defined(_POINT_LOG_H)
+#define _POINT_LOG_H
+
+#include <main.h>
+#include "data.h"
+
+/*
+ * One version of a scored point. (clock, device_id) names the version,
+ * so every device scoring a match must have a different id.
+ */
+typedef struct {
+	unsigned int clock;
+	unsigned int device_id;
+	unsigned char winner;
+} point_op;
+
+/*
+ * Operation log of a single match as seen by one device.
+ * states[i] is the match score after ops[i] has been applied.
+ *
+ * Devices scoring the same match record mostly the same real points, but
+ * one may miss a tap or record an extra one. After a merge both logs hold
+ * the same ops, and the ops recorded after them are aligned at the next
+ * merge: two versions of one real point are paired and the one recorded by
+ * the device with the lower id is kept, which decides the point when the
+ * devices disagree, while a point only one device recorded is kept as is.
+ */
+struct point_log {
+	point_op *ops;
+	struct match_score *states;
+	int count;
+	int capacity;
+	unsigned int clock;
+	unsigned int device_id;
+};
+
+void point_log_init(struct point_log *log, unsigned int device_id);
+void point_log_fini(struct point_log *log);
+void point_log_reset(struct point_log *log);
+bool point_log_append(struct point_log *log, key_type winner);
+int point_log_merge(struct point_log *log, const struct point_log *remote);
+void point_log_get_score(const struct point_log *log, struct match_score *score_out);
+bool point_log_wins_match(const struct point_log *log, int i);
+
+#endif
@@ -0,0 +1,16 @@
+#if !defined(_POWER_H)
+#define _POWER_H
+
+#include <main.h>
+
+struct power_stats {
+	double paused_sec;
+	double cpu_sec;
+	long wakeups;
+};
+
+void power_pause_begin(void);
+void power_pause_end(void);
+void power_get_stats(struct power_stats *stats_out);
+
+#endif
@@ -0,0 +1,41 @@
+#if !defined(_RATING_H)
+#define _RATING_H
+
+#include <main.h>
+#include "string_pool.h"
+
+#define RATING_PERIOD_DAYS 30
+
+/*
+ * A finished match. Players are named by their interned ids, and the
+ * period is the Glicko rating period the match was played in.
+ */
+struct rating_result {
+	string_id winner;
+	string_id loser;
+	unsigned int period;
+	unsigned char sets_winner;
+	unsigned char sets_loser;
+	unsigned short games_winner;
+	unsigned short games_loser;
+};
+
+struct rating_player {
+	double rating;
+	double rd;
+	unsigned int last_period;
+	unsigned int matches;
+};
+
+struct rating_engine;
+
+struct rating_engine *rating_engine_create(bool weighted);
+void rating_engine_destroy(struct rating_engine *engine);
+bool rating_engine_add_result(struct rating_engine *engine, const struct rating_result *result);
+bool rating_engine_remove_result(struct rating_engine *engine, const struct rating_result *result);
+bool rating_engine_import(struct rating_engine *engine, const struct rating_result *results, int count);
+bool rating_engine_rerate(struct rating_engine *engine);
+bool rating_engine_get(const struct rating_engine *engine, string_id player, struct rating_player *player_out);
+unsigned int rating_current_period(void);
+
+#endif
@@ -0,0 +1,31 @@
+#if !defined(_SIMILARITY_H)
+#define _SIMILARITY_H
+
+#include <main.h>
+#include "data.h"
+#include "point_log.h"
+
+#define SIMILARITY_DIMS 32
+#define SIMILARITY_TRAJECTORY_SAMPLES 24
+
+/*
+ * Fixed-size summary of how a match unfolded, unit length and quantized
+ * to 8 bits per dimension. The first SIMILARITY_TRAJECTORY_SAMPLES
+ * dimensions sample the lead in games along the match, the rest hold
+ * breaks, lead changes, runs of games and the length of the match.
+ */
+struct similarity_fingerprint {
+	signed char v[SIMILARITY_DIMS];
+};
+
+struct similarity_index;
+
+void similarity_fingerprint_compute(const struct point_log *log, struct similarity_fingerprint *fp_out);
+struct similarity_index *similarity_index_create(void);
+void similarity_index_destroy(struct similarity_index *index);
+int similarity_index_add(struct similarity_index *index, match_handle handle, const struct similarity_fingerprint *fp);
+void similarity_index_remove(struct similarity_index *index, int item);
+int similarity_index_query(struct similarity_index *index, const struct similarity_fingerprint *fp, match_handle exclude, int k, match_handle *handles_out, float *scores_out);
+int similarity_index_count(const struct similarity_index *index);
+
+#endif
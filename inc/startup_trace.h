@@ -0,0 +1,10 @@
+#if !defined(_STARTUP_TRACE_H)
+#define _STARTUP_TRACE_H
+
+#include <main.h>
+
+void startup_trace_begin(void);
+void startup_trace_mark(const char *phase);
+void startup_trace_end(const char *phase);
+
+#endif
@@ -0,0 +1,23 @@
+#if !defined(_STRING_POOL_H)
+#define _STRING_POOL_H
+
+#include <main.h>
+
+/*
+ * Id of an interned string. Equal strings get the same id while one of
+ * them is interned, and 0 never names a string. Every intern takes a
+ * reference, and once the last one is released the id may be reused.
+ */
+typedef unsigned int string_id;
+
+struct string_pool;
+
+struct string_pool *string_pool_create(void);
+void string_pool_destroy(struct string_pool *pool);
+string_id string_pool_intern(struct string_pool *pool, const char *str);
+void string_pool_retain(struct string_pool *pool, string_id id);
+void string_pool_release(struct string_pool *pool, string_id id);
+const char *string_pool_get(const struct string_pool *pool, string_id id);
+int string_pool_count(const struct string_pool *pool);
+
+#endif
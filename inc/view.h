@@ -12,6 +12,10 @@ Evas_Object *view_create_win(const char *pkg_name);
 Evas_Object *view_create_conformant_without_indicator(Evas_Object *win);
 void view_init_tennis_scores_theme(char *theme);
 void view_fini_tennis_scores_theme(char *theme);
+void view_add_render_post_cb(Evas_Event_Cb cb, void *user_data);
+void view_del_render_post_cb(Evas_Event_Cb cb);
+void view_pause(void);
+void view_resume(void);
 void view_destroy(void);
 void view_create_tennis_scores_layout(char *file_path, char *group_name);
 Evas_Object *view_create_layout_for_conformant(Evas_Object *parent, const char *file_path, const char *group_name, Eext_Event_Cb cb_function, void *user_data);
@@ -22,7 +26,11 @@ void view_create_op_points_label(void);
 void view_create_my_scores_label(void);
 void view_create_op_scores_label(void);
 void view_create_scores_button(button_score *btn_score, Evas_Smart_Cb clicked_cb);
+void view_create_match_list(Evas_Smart_Cb selected_cb);
+void view_show_match_list(void);
+void view_show_match(void);
 void view_display_my_scores(int points, int game, int set);
 void view_display_op_scores(int points, int game, int set);
+void view_clear_scores(void);
 
 #endif
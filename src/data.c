@@ -1,28 +1,296 @@
+#include <time.h>
+#include <unistd.h>
 #include <dlog.h>
 #include <efl_extension.h>
 #include <app_common.h>
+#include <system_info.h>
 #include <main.h>
 #include <media_content.h>
 #include "data.h"
+#include "point_log.h"
+#include "match_registry.h"
+#include "moment.h"
+#include "rating.h"
+#include "pace.h"
+#include "similarity.h"
 
-static struct score my_score = {
-	.point_won = POINT_LOVE,
-	.game_won = GAME_ZERO,
-	.set_won = SET_ZERO,
-};
+#define DATA_TIZEN_ID_KEY "http://tizen.org/system/tizenid"
+/* Derived device ids have the top bit set, so ids set by hand below it win disputed points */
+#define DATA_DEVICE_ID_DERIVED 0x80000000u
 
-static struct score op_score = {
-	.point_won = POINT_LOVE,
-	.game_won = GAME_ZERO,
-	.set_won = SET_ZERO
+/**
+ * Matches scored on this device.
+ */
+static struct data_info {
+	struct match_registry *registry;
+	struct moment_rules *moments;
+	struct rating_engine *ratings;
+	struct similarity_index *similar;
+	match_handle active;
+	unsigned int device_id;
+	char *my_name;
+	char *op_name;
+} s_info = {
+	.registry = NULL,
+	.moments = NULL,
+	.ratings = NULL,
+	.similar = NULL,
+	.active = MATCH_HANDLE_INVALID,
+	.device_id = 0,
+	.my_name = NULL,
+	.op_name = NULL,
 };
 
+/*
+ * @brief Gets the match currently being scored.
+ */
+static struct match *_data_get_active_match(void)
+{
+	if (s_info.registry == NULL)
+		return NULL;
+
+	return match_registry_get(s_info.registry, s_info.active);
+}
+
+/*
+ * @brief Derives the id this device stamps on its points from the unique id of the device.
+ */
+static unsigned int _data_derive_device_id(void)
+{
+	unsigned int hash = 2166136261u;
+	char *tizen_id = NULL;
+	const char *p;
+
+	if (system_info_get_platform_string(DATA_TIZEN_ID_KEY, &tizen_id) == SYSTEM_INFO_ERROR_NONE && tizen_id) {
+		for (p = tizen_id; *p; p++) {
+			hash ^= (unsigned char)*p;
+			hash *= 16777619u;
+		}
+		free(tizen_id);
+	} else {
+		dlog_print(DLOG_WARN, LOG_TAG, "Failed to get the device id, using a random one");
+		hash ^= (unsigned int)time(NULL) * 16777619u ^ (unsigned int)getpid();
+	}
+
+	return hash | DATA_DEVICE_ID_DERIVED;
+}
+
+/*
+ * @brief Creates the match registry and the first match.
+ * The key moment rules are compiled later by data_compile_moments().
+ */
+bool data_initialize(void)
+{
+	s_info.device_id = _data_derive_device_id();
+
+	s_info.registry = match_registry_create();
+	if (s_info.registry == NULL)
+		return false;
+
+	s_info.ratings = rating_engine_create(true);
+	if (s_info.ratings == NULL) {
+		data_finalize();
+		return false;
+	}
+
+	s_info.active = data_add_match(NULL, NULL);
+	if (s_info.active == MATCH_HANDLE_INVALID) {
+		data_finalize();
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * @brief Feeds the points a match has already been scored on to its key moment detector.
+ */
+static void _data_catch_up_moments(match_handle handle, struct match *match, void *user_data)
+{
+	int i;
+
+	for (i = moment_history_resume(&match->moment_checkpoints, 0, &match->moments); i < match->log.count; i++) {
+		moment_stream_feed(s_info.moments, &match->moments, match->log.ops[i].winner, &match->log.states[i]);
+		moment_history_save(&match->moment_checkpoints, &match->moments, i + 1);
+	}
+}
+
+/*
+ * @brief Compiles the key moment rules.
+ * Until then no moment is detected, the points scored in the meantime are
+ * fed to the detectors here without reporting their moments.
+ * @return true on success, false if the rules could not be compiled
+ */
+bool data_compile_moments(void)
+{
+	if (s_info.moments)
+		return true;
+
+	s_info.moments = moment_rules_compile(MOMENT_DEFAULT_RULES);
+	if (s_info.moments == NULL)
+		return false;
+
+	if (s_info.registry)
+		match_registry_foreach(s_info.registry, _data_catch_up_moments, NULL);
+
+	return true;
+}
+
+/*
+ * @brief Destroys every match scored on this device.
+ */
+void data_finalize(void)
+{
+	similarity_index_destroy(s_info.similar);
+	s_info.similar = NULL;
+	rating_engine_destroy(s_info.ratings);
+	s_info.ratings = NULL;
+	moment_rules_destroy(s_info.moments);
+	s_info.moments = NULL;
+	match_registry_destroy(s_info.registry);
+	s_info.registry = NULL;
+	s_info.active = MATCH_HANDLE_INVALID;
+	free(s_info.my_name);
+	s_info.my_name = NULL;
+	free(s_info.op_name);
+	s_info.op_name = NULL;
+}
+
+/*
+ * @brief Gets the registry of the matches scored on this device.
+ */
+struct match_registry *data_get_registry(void)
+{
+	return s_info.registry;
+}
+
+/*
+ * @brief Gets the ratings of the players of the finished matches.
+ */
+struct rating_engine *data_get_ratings(void)
+{
+	return s_info.ratings;
+}
+
+/*
+ * @brief Sets the names the next matches are created with.
+ * Players are rated by name, so every opponent gets a rating of their own.
+ * The active match takes the names too if it has no point yet, e.g. when
+ * the application is launched with them.
+ * @param[in] my_name Name of the player scoring on this device, NULL to keep it
+ * @param[in] op_name Name of the opponent, NULL to keep it
+ * @return false if a name cannot be stored
+ */
+bool data_set_player_names(const char *my_name, const char *op_name)
+{
+	char *my_copy = my_name ? strdup(my_name) : NULL;
+	char *op_copy = op_name ? strdup(op_name) : NULL;
+	struct match *match;
+
+	if ((my_name && my_copy == NULL) || (op_name && op_copy == NULL)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to set player names");
+		free(my_copy);
+		free(op_copy);
+		return false;
+	}
+
+	if (my_copy) {
+		free(s_info.my_name);
+		s_info.my_name = my_copy;
+	}
+	if (op_copy) {
+		free(s_info.op_name);
+		s_info.op_name = op_copy;
+	}
+
+	match = _data_get_active_match();
+	if (match && match->log.count == 0)
+		return match_registry_rename(s_info.registry, s_info.active,
+				s_info.my_name ? s_info.my_name : DATA_MY_NAME, s_info.op_name ? s_info.op_name : DATA_OP_NAME);
+
+	return true;
+}
+
+/*
+ * @brief Creates a new match.
+ * @param[in] my_name Name of the player scoring on this device, NULL for the one set by data_set_player_names()
+ * @param[in] op_name Name of the opponent, NULL for the one set by data_set_player_names()
+ */
+match_handle data_add_match(const char *my_name, const char *op_name)
+{
+	match_handle handle;
+	struct match *match;
+
+	if (my_name == NULL)
+		my_name = s_info.my_name ? s_info.my_name : DATA_MY_NAME;
+	if (op_name == NULL)
+		op_name = s_info.op_name ? s_info.op_name : DATA_OP_NAME;
+
+	handle = match_registry_add(s_info.registry, my_name, op_name);
+	match = match_registry_get(s_info.registry, handle);
+	if (match == NULL)
+		return MATCH_HANDLE_INVALID;
+
+	match->log.device_id = s_info.device_id;
+
+	return handle;
+}
+
+/*
+ * @brief Gets the handle of the match currently being scored.
+ */
+match_handle data_get_active_match(void)
+{
+	return s_info.active;
+}
+
+/*
+ * @brief Sets the match the score buttons are scoring.
+ * @return false if the handle does not name a live match
+ */
+bool data_set_active_match(match_handle handle)
+{
+	if (match_registry_get(s_info.registry, handle) == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "No such match");
+		return false;
+	}
+
+	s_info.active = handle;
+
+	return true;
+}
+
+/*
+ * @brief Retires a match, it is no longer offered as a similar match.
+ * @return false if the handle does not name a live match
+ */
+bool data_retire_match(match_handle handle)
+{
+	struct match *match = match_registry_get(s_info.registry, handle);
+
+	if (match == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "No such match");
+		return false;
+	}
+
+	if (match->similar_item >= 0 && s_info.similar)
+		similarity_index_remove(s_info.similar, match->similar_item);
+	match->similar_item = -1;
+
+	if (handle == s_info.active)
+		s_info.active = MATCH_HANDLE_INVALID;
+
+	return match_registry_retire(s_info.registry, handle);
+}
+
 /*
  * @brief Gets the my score.
  */
 struct score *data_get_my_score(void)
 {
-	return &my_score;
+	struct match *match = _data_get_active_match();
+
+	return match ? &match->score.my : NULL;
 }
 
 /*
@@ -30,38 +298,303 @@ struct score *data_get_my_score(void)
  */
 struct score *data_get_opponent_score(void)
 {
-	return &op_score;
+	struct match *match = _data_get_active_match();
+
+	return match ? &match->score.op : NULL;
 }
 
+/*
+ * @brief Adds a point to the given score.
+ * @param[in] score The score of the player who won the point
+ * @return true if the point won the match
+ */
+bool data_score_add_point(struct score *score)
+{
+	score->point_won = score->point_won + 1;
+
+	if (score->point_won == POINT_GAME){
+		score->point_won = POINT_LOVE;
+		score->game_won = score->game_won + 1;
+	}
+
+	if (score->game_won == GAME_SET){
+		score->game_won = GAME_ZERO;
+		score->set_won = score->set_won + 1;
+	}
+
+	if (score->set_won == SET_MATCH){
+		score->set_won = SET_ZERO;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * @brief Adds a point to the side of the match that won it.
+ * @param[in] match The score of the match
+ * @param[in] winner Which side won the point
+ */
+void data_match_score_add_point(struct match_score *match, key_type winner)
+{
+	if (winner == KEY_TYPE_ME)
+		data_score_add_point(&match->my);
+	else
+		data_score_add_point(&match->op);
+}
+
+/*
+ * @brief Runs the key moment rules over the last point of the match.
+ * @param[in] match The match the point was scored in
+ * @param[in] winner Which side won the point
+ */
+static void _data_detect_moments(struct match *match, key_type winner)
+{
+	unsigned int fired;
+	int i;
+
+	if (s_info.moments == NULL)
+		return;
+
+	fired = moment_stream_feed(s_info.moments, &match->moments, winner, &match->score);
+	moment_history_save(&match->moment_checkpoints, &match->moments, match->log.count);
+	for (i = 0; fired; i++, fired >>= 1) {
+		if (fired & 1)
+			dlog_print(DLOG_INFO, LOG_TAG, "key moment: %s", moment_rules_name(s_info.moments, i));
+	}
+}
+
+/*
+ * @brief Rates the players of a match that has just been won.
+ * The game margin is counted from the point log, since the score itself
+ * only holds the games of the current set. A merge can bring in points
+ * played after the win, so only the points up to it are counted.
+ * @param[in] match The finished match
+ * @param[in] points Number of points up to the one that won the match
+ */
+static void _data_rate_match(struct match *match, int points)
+{
+	const struct match_score *score = &match->log.states[points - 1];
+	key_type winner = match->log.ops[points - 1].winner;
+	struct rating_result result = { 0, };
+	struct rating_player player;
+	int games[2] = { 0, 0 };
+	bool new_winner;
+	bool new_loser;
+	int i;
+
+	/* Only the side that won a game has its points back to love */
+	for (i = 0; i < points; i++) {
+		const struct match_score *state = &match->log.states[i];
+
+		if (match->log.ops[i].winner == KEY_TYPE_ME && state->my.point_won == POINT_LOVE)
+			games[KEY_TYPE_ME]++;
+		else if (match->log.ops[i].winner != KEY_TYPE_ME && state->op.point_won == POINT_LOVE)
+			games[KET_TYPE_OPPONENT]++;
+	}
+
+	result.period = rating_current_period();
+	result.sets_winner = SET_MATCH;
+	if (winner == KEY_TYPE_ME) {
+		result.winner = match->my_name;
+		result.loser = match->op_name;
+		result.sets_loser = score->op.set_won;
+		result.games_winner = games[KEY_TYPE_ME];
+		result.games_loser = games[KET_TYPE_OPPONENT];
+	} else {
+		result.winner = match->op_name;
+		result.loser = match->my_name;
+		result.sets_loser = score->my.set_won;
+		result.games_winner = games[KET_TYPE_OPPONENT];
+		result.games_loser = games[KEY_TYPE_ME];
+	}
+
+	new_winner = !rating_engine_get(s_info.ratings, result.winner, &player);
+	new_loser = !rating_engine_get(s_info.ratings, result.loser, &player);
+	if (!rating_engine_add_result(s_info.ratings, &result))
+		return;
+	match->result = result;
+
+	/* Ratings are kept by name id, so a rated name stays interned after its matches are retired */
+	if (new_winner)
+		match_registry_retain_name(s_info.registry, result.winner);
+	if (new_loser)
+		match_registry_retain_name(s_info.registry, result.loser);
+}
+
+/*
+ * @brief Takes back the rating of a match, and the names no other result rates.
+ * @param[in] match The match rated by _data_rate_match()
+ */
+static void _data_unrate_match(struct match *match)
+{
+	struct rating_player player;
+
+	if (match->result.winner == 0 || !rating_engine_remove_result(s_info.ratings, &match->result))
+		return;
+
+	if (!rating_engine_get(s_info.ratings, match->result.winner, &player))
+		match_registry_release_name(s_info.registry, match->result.winner);
+	if (!rating_engine_get(s_info.ratings, match->result.loser, &player))
+		match_registry_release_name(s_info.registry, match->result.loser);
+
+	memset(&match->result, 0, sizeof(match->result));
+}
+
+/*
+ * @brief Adds a match that has just been won to the similarity index.
+ * The index is only created once the first match is over, so starting
+ * the application does not pay for its buckets.
+ * @param[in] handle Handle of the match
+ * @param[in] match The finished match
+ */
+static void _data_index_match(match_handle handle, struct match *match)
+{
+	struct similarity_fingerprint fp;
+
+	if (s_info.similar == NULL) {
+		s_info.similar = similarity_index_create();
+		if (s_info.similar == NULL)
+			return;
+	}
+
+	similarity_fingerprint_compute(&match->log, &fp);
+	match->similar_item = similarity_index_add(s_info.similar, handle, &fp);
+}
+
+/*
+ * @brief Rates and indexes a match the first time it is won.
+ * Points scored after the win do not finish it again.
+ * @param[in] handle Handle of the match
+ * @param[in] match The match
+ * @param[in] points Number of points up to the one that won the match
+ */
+static void _data_finish_match(match_handle handle, struct match *match, int points)
+{
+	if (match->finished)
+		return;
+
+	match->finished = true;
+	match->win_points = points;
+	_data_rate_match(match, points);
+	_data_index_match(handle, match);
+}
+
+/*
+ * @brief Undoes _data_finish_match() when a merge rewrites the points up to the win.
+ * @param[in] match The finished match
+ */
+static void _data_unfinish_match(struct match *match)
+{
+	_data_unrate_match(match);
+
+	if (match->similar_item >= 0 && s_info.similar)
+		similarity_index_remove(s_info.similar, match->similar_item);
+	match->similar_item = -1;
+
+	match->finished = false;
+	match->win_points = 0;
+}
+
+/*
+ * @brief Gets the kind of break that follows a point.
+ * Players change ends after every odd game and after each set. The
+ * detector must have been fed the point, it counts the games played.
+ * @param[in] match The match the point was scored in
+ * @param[in] winner Which side won the point
+ * @param[in] after The score after the point
+ */
+static pace_interval _data_next_interval(const struct match *match, key_type winner, const struct match_score *after)
+{
+	const struct score *score = winner == KEY_TYPE_ME ? &after->my : &after->op;
+
+	if (score->point_won != POINT_LOVE)
+		return PACE_INTERVAL_POINT;
+	if (score->game_won == GAME_ZERO)
+		return PACE_INTERVAL_SET_BREAK;
+	if (match->moments.games_played & 1)
+		return PACE_INTERVAL_CHANGEOVER;
+
+	return PACE_INTERVAL_POINT;
+}
+
+/*
+ * @brief Timestamps the end of a point and checks the break and rally before it.
+ * @param[in] match The match the point was scored in
+ * @param[in] winner Which side won the point
+ */
+static void _data_record_pace(struct match *match, key_type winner)
+{
+	pace_event event;
+
+	event = pace_record_point(&match->pace, pace_now_ms(), _data_next_interval(match, winner, &match->score));
+	if (event == PACE_EVENT_SLOW_POINT)
+		dlog_print(DLOG_INFO, LOG_TAG, "slow point: likely over the serve clock");
+	else if (event == PACE_EVENT_SLOW_CHANGEOVER)
+		dlog_print(DLOG_INFO, LOG_TAG, "slow changeover: likely over the break limit");
+}
+
+#if defined(SCORE_VERIFY)
+/*
+ * @brief Checks the incremental scores of the point log against the reference rules.
+ * The score kept by data_add_* must match both the score the log cached for
+ * the last point and a replay of the whole log from love-all.
+ * @param[in] match The match the point was scored in
+ */
+static void _data_verify_score(const struct match *match)
+{
+	struct match_score cached;
+	struct match_score replay = { { 0, }, { 0, } };
+	int i;
+
+	point_log_get_score(&match->log, &cached);
+	for (i = 0; i < match->log.count; i++)
+		data_match_score_add_point(&replay, match->log.ops[i].winner);
+
+	if (memcmp(&cached, &match->score, sizeof(cached)) || memcmp(&replay, &match->score, sizeof(replay)))
+		dlog_print(DLOG_ERROR, LOG_TAG, "score mismatch after point %d", match->log.count);
+}
+#endif
+
 /*
  * @brief Add my score.
  */
 void data_add_my_score(button_score *btn_score)
 {
+	struct match *match;
+	struct score *my_score;
+
 	if (btn_score == NULL) {
 		dlog_print(DLOG_ERROR, LOG_TAG, "My score button is NULL");
 	}
 
-	my_score.point_won = my_score.point_won + 1;
-
-	if (my_score.point_won == POINT_GAME){
-		my_score.point_won = POINT_LOVE;
-		my_score.game_won = my_score.game_won + 1;
+	match = _data_get_active_match();
+	if (match == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "No match is being scored");
+		return;
 	}
+	my_score = &match->score.my;
 
-	if (my_score.game_won == GAME_SET){
-		my_score.game_won = GAME_ZERO;
-		my_score.set_won = my_score.set_won + 1;
+	if (!point_log_append(&match->log, KEY_TYPE_ME)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to record my point");
+		return;
 	}
 
-	if (my_score.set_won == SET_MATCH){
-		my_score.set_won = SET_ZERO;
+	if (data_score_add_point(my_score)) {
 		dlog_print(DLOG_INFO, LOG_TAG, "YOU WIN THE MATCH! CONGRATULATIONS!");
+		_data_finish_match(s_info.active, match, match->log.count);
 	}
 
-	dlog_print(DLOG_INFO, LOG_TAG, "my_score.point_won: %d", my_score.point_won);
-	dlog_print(DLOG_INFO, LOG_TAG, "my_score.game_won: %d", my_score.game_won);
-	dlog_print(DLOG_INFO, LOG_TAG, "my_score.set_won: %d", my_score.set_won);
+	dlog_print(DLOG_INFO, LOG_TAG, "my_score.point_won: %d", my_score->point_won);
+	dlog_print(DLOG_INFO, LOG_TAG, "my_score.game_won: %d", my_score->game_won);
+	dlog_print(DLOG_INFO, LOG_TAG, "my_score.set_won: %d", my_score->set_won);
+
+	_data_detect_moments(match, KEY_TYPE_ME);
+	_data_record_pace(match, KEY_TYPE_ME);
+
+#if defined(SCORE_VERIFY)
+	_data_verify_score(match);
+#endif
 
 }
 
@@ -70,31 +603,145 @@ void data_add_my_score(button_score *btn_score)
  */
 void data_add_opponent_score(button_score *btn_score)
 {
+	struct match *match;
+	struct score *op_score;
+
 	if (btn_score == NULL) {
 		dlog_print(DLOG_ERROR, LOG_TAG, "Opponent button is NULL");
 	}
 
-	op_score.point_won = op_score.point_won + 1;
-
-	if (op_score.point_won == POINT_GAME){
-		op_score.point_won = POINT_LOVE;
-		op_score.game_won = op_score.game_won + 1;
+	match = _data_get_active_match();
+	if (match == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "No match is being scored");
+		return;
 	}
+	op_score = &match->score.op;
 
-	if (op_score.game_won == GAME_SET){
-		op_score.game_won = GAME_ZERO;
-		op_score.set_won = op_score.set_won + 1;
+	if (!point_log_append(&match->log, KET_TYPE_OPPONENT)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to record the opponent's point");
+		return;
 	}
 
-	if (op_score.set_won == SET_MATCH){
-		op_score.set_won = SET_ZERO;
+	if (data_score_add_point(op_score)) {
 		dlog_print(DLOG_INFO, LOG_TAG, "YOU WIN THE MATCH! CONGRATULATIONS!");
+		_data_finish_match(s_info.active, match, match->log.count);
 	}
 
-	dlog_print(DLOG_INFO, LOG_TAG, "op_score.point_won: %d", op_score.point_won);
-	dlog_print(DLOG_INFO, LOG_TAG, "op_score.game_won: %d", op_score.game_won);
-	dlog_print(DLOG_INFO, LOG_TAG, "op_score.set_won: %d", op_score.set_won);
+	dlog_print(DLOG_INFO, LOG_TAG, "op_score.point_won: %d", op_score->point_won);
+	dlog_print(DLOG_INFO, LOG_TAG, "op_score.game_won: %d", op_score->game_won);
+	dlog_print(DLOG_INFO, LOG_TAG, "op_score.set_won: %d", op_score->set_won);
+
+	_data_detect_moments(match, KET_TYPE_OPPONENT);
+	_data_record_pace(match, KET_TYPE_OPPONENT);
+
+#if defined(SCORE_VERIFY)
+	_data_verify_score(match);
+#endif
+
+}
+
+/*
+ * @brief Sets the id this device stamps on its points.
+ * Every device scoring the same match must use a different id, and when
+ * two devices disagree on a point the one with the lower id is kept.
+ * By default the id is derived from the device, above any id set here.
+ */
+void data_set_device_id(unsigned int device_id)
+{
+	struct match *match = _data_get_active_match();
+
+	s_info.device_id = device_id;
+	if (match)
+		match->log.device_id = device_id;
+}
+
+/*
+ * @brief Gets the point log of the match currently being scored.
+ */
+const struct point_log *data_get_point_log(void)
+{
+	struct match *match = _data_get_active_match();
+
+	return match ? &match->log : NULL;
+}
+
+/*
+ * @brief Finds the finished matches that unfolded most like a given match.
+ * @param[in] handle The match to compare with, finished or not
+ * @param[in] k Number of matches wanted
+ * @param[out] handles_out Handles of the most similar matches, best first
+ * @param[out] scores_out Similarity of each match, 1 for the same trajectory
+ * @return Number of matches found, at most k
+ */
+int data_find_similar_matches(match_handle handle, int k, match_handle *handles_out, float *scores_out)
+{
+	struct similarity_fingerprint fp;
+	struct match *match;
+
+	match = match_registry_get(s_info.registry, handle);
+	if (match == NULL || s_info.similar == NULL || k <= 0)
+		return 0;
+
+	similarity_fingerprint_compute(&match->log, &fp);
+
+	/* A finished match is in the index too, and would always match itself best */
+	return similarity_index_query(s_info.similar, &fp, handle, k, handles_out, scores_out);
+}
+
+/*
+ * @brief Merges the points scored on another device into the current match.
+ * The detectors resume from the last checkpoint before the first rescored
+ * point, so a merge costs the points it changed rather than the whole
+ * match. Points new to this device are counted in the pace without a time,
+ * and a match they win is rated and indexed like one won here. A merge
+ * that rewrites the points up to a win takes back its rating and index
+ * entry first, so a match that no longer ends that way is not left rated.
+ * @param[in] remote The point log received from the other device
+ * @return true if the score was reconciled
+ */
+bool data_merge_point_log(const struct point_log *remote)
+{
+	struct match *match = _data_get_active_match();
+	int known;
+	int diverge;
+	int i;
+
+	if (match == NULL)
+		return false;
+
+	known = match->log.count;
+	diverge = point_log_merge(&match->log, remote);
+	if (diverge < 0)
+		return false;
+
+	if (diverge == match->log.count)
+		return true;
+
+	point_log_get_score(&match->log, &match->score);
+
+	/* The win was rated and indexed on points that are no longer the same, it is found again below */
+	if (match->finished && diverge < match->win_points)
+		_data_unfinish_match(match);
+
+	/* Catch the detectors up with the merged points without reporting old moments */
+	i = s_info.moments ? moment_history_resume(&match->moment_checkpoints, diverge, &match->moments) : diverge;
+	for (; i < match->log.count; i++) {
+		key_type winner = match->log.ops[i].winner;
+		const struct match_score *after = &match->log.states[i];
+
+		if (s_info.moments) {
+			moment_stream_feed(s_info.moments, &match->moments, winner, after);
+			moment_history_save(&match->moment_checkpoints, &match->moments, i + 1);
+		}
+
+		if (i >= known)
+			pace_record_untimed(&match->pace, _data_next_interval(match, winner, after));
+
+		if (i >= diverge && point_log_wins_match(&match->log, i))
+			_data_finish_match(s_info.active, match, i + 1);
+	}
 
+	return true;
 }
 
 /*
@@ -0,0 +1,587 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlog.h>
+#include <main.h>
+#include "data.h"
+#include "match_registry.h"
+#include "export.h"
+
+#define EXPORT_BUFFER_MIN 4096
+/* Slots per worker, so workers can run ahead of a slow write */
+#define EXPORT_SLOTS_PER_THREAD 2
+#define EXPORT_POINTS (POINT_40 + 1)
+#define EXPORT_GAMES (GAME_FIVE + 1)
+#define EXPORT_SETS (SET_TWO + 1)
+#define EXPORT_CSV_HEADER "match,point,me,opponent,winner,score\n"
+
+/*
+ * Score strings rendered once, so a row is built from a few memcpy calls.
+ */
+struct export_string {
+	char text[8];
+	int len;
+};
+
+static struct export_strings {
+	struct export_string points[EXPORT_POINTS][EXPORT_POINTS];
+	struct export_string games[EXPORT_GAMES][EXPORT_GAMES];
+	struct export_string sets[EXPORT_SETS][EXPORT_SETS];
+	pthread_once_t once;
+} s_strings = {
+	.once = PTHREAD_ONCE_INIT,
+};
+
+/*
+ * Growable output buffer. Buffers are reused from match to match, so they
+ * stop allocating once they have grown to the longest match.
+ */
+struct export_buffer {
+	char *data;
+	size_t len;
+	size_t capacity;
+};
+
+/*
+ * One match as it was when the snapshot was taken.
+ */
+struct export_match {
+	const char *my_name;
+	const char *op_name;
+	const point_op *ops;
+	const struct match_score *states;
+	int count;
+};
+
+/*
+ * Copy of the points and names of every live match, so the export can run
+ * on another thread while the main loop goes on scoring.
+ */
+struct export_snapshot {
+	struct export_match *matches;
+	int match_count;
+	point_op *ops;
+	struct match_score *states;
+	char *names;
+	/* Filled in while the snapshot is taken */
+	int points;
+	size_t names_len;
+	const struct match_registry *registry;
+};
+
+struct export_slot {
+	struct export_buffer out;
+	struct export_buffer names;
+	/* Index of the match whose rows are ready in 'out', -1 if none */
+	int ready;
+};
+
+/*
+ * Shared state of an export. Match 'i' is formatted into slot
+ * i % slot_count, and the calling thread writes the slots in match order,
+ * so the output does not depend on how the workers are scheduled.
+ */
+struct export_job {
+	const struct export_match *matches;
+	int match_count;
+	export_format format;
+	struct export_slot *slots;
+	int slot_count;
+	int next;
+	int written;
+	bool failed;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/*
+ * @brief Renders the score string tables.
+ */
+static void _export_strings_init(void)
+{
+	static const char *points[EXPORT_POINTS] = { "0", "15", "30", "40" };
+	int i, j;
+
+	for (i = 0; i < EXPORT_POINTS; i++)
+		for (j = 0; j < EXPORT_POINTS; j++)
+			s_strings.points[i][j].len = snprintf(s_strings.points[i][j].text, sizeof(s_strings.points[i][j].text), "%s-%s", points[i], points[j]);
+
+	for (i = 0; i < EXPORT_GAMES; i++)
+		for (j = 0; j < EXPORT_GAMES; j++)
+			s_strings.games[i][j].len = snprintf(s_strings.games[i][j].text, sizeof(s_strings.games[i][j].text), "%d-%d", i, j);
+
+	for (i = 0; i < EXPORT_SETS; i++)
+		for (j = 0; j < EXPORT_SETS; j++)
+			s_strings.sets[i][j].len = snprintf(s_strings.sets[i][j].text, sizeof(s_strings.sets[i][j].text), "%d-%d", i, j);
+}
+
+/*
+ * @brief Makes room for 'len' more bytes in the buffer.
+ */
+static bool _export_reserve(struct export_buffer *buf, size_t len)
+{
+	size_t capacity;
+	char *data;
+
+	if (buf->len + len <= buf->capacity)
+		return true;
+
+	capacity = buf->capacity ? buf->capacity : EXPORT_BUFFER_MIN;
+	while (capacity < buf->len + len)
+		capacity *= 2;
+
+	data = realloc(buf->data, capacity);
+	if (data == NULL)
+		return false;
+
+	buf->data = data;
+	buf->capacity = capacity;
+
+	return true;
+}
+
+/*
+ * @brief Appends bytes to a buffer that has room for them.
+ */
+static void _export_put(struct export_buffer *buf, const char *data, size_t len)
+{
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+/*
+ * @brief Appends an unsigned number to a buffer that has room for it.
+ */
+static void _export_put_uint(struct export_buffer *buf, unsigned int value)
+{
+	char digits[10];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	while (n)
+		buf->data[buf->len++] = digits[--n];
+}
+
+/*
+ * @brief Appends a name quoted for the output format.
+ */
+static bool _export_put_name(struct export_buffer *buf, const char *name, export_format format)
+{
+	const char *p;
+
+	if (name == NULL)
+		name = "";
+
+	/* Every character takes at most six bytes once escaped, plus the quotes and snprintf's terminator */
+	if (!_export_reserve(buf, strlen(name) * 6 + 3))
+		return false;
+
+	buf->data[buf->len++] = '"';
+	for (p = name; *p; p++) {
+		unsigned char c = *p;
+
+		if (format == EXPORT_FORMAT_CSV) {
+			if (c == '"')
+				buf->data[buf->len++] = '"';
+			buf->data[buf->len++] = c;
+		} else if (c == '"' || c == '\\') {
+			buf->data[buf->len++] = '\\';
+			buf->data[buf->len++] = c;
+		} else if (c < 0x20) {
+			buf->len += snprintf(buf->data + buf->len, 7, "\\u%04x", c);
+		} else {
+			buf->data[buf->len++] = c;
+		}
+	}
+	buf->data[buf->len++] = '"';
+
+	return true;
+}
+
+/*
+ * @brief Appends a score such as "40-15, 5-4, 1-0" to a buffer that has room for it.
+ */
+static void _export_put_score(struct export_buffer *buf, const struct match_score *score)
+{
+	const struct export_string *str;
+
+	str = &s_strings.points[score->my.point_won][score->op.point_won];
+	_export_put(buf, str->text, str->len);
+	_export_put(buf, ", ", 2);
+	str = &s_strings.games[score->my.game_won][score->op.game_won];
+	_export_put(buf, str->text, str->len);
+	_export_put(buf, ", ", 2);
+	str = &s_strings.sets[score->my.set_won][score->op.set_won];
+	_export_put(buf, str->text, str->len);
+}
+
+/*
+ * @brief Formats every point of one match.
+ * @param[in] job The export
+ * @param[in] index Index of the match in the export
+ * @param[in] slot Slot the rows are written to
+ */
+static bool _export_format_match(const struct export_job *job, int index, struct export_slot *slot)
+{
+	const struct export_match *match = &job->matches[index];
+	/* Longest row: two numbers, the quoted names, the winner and the score */
+	size_t row_max;
+	int i;
+
+	slot->out.len = 0;
+	slot->names.len = 0;
+
+	if (job->format == EXPORT_FORMAT_CSV) {
+		if (!_export_put_name(&slot->names, match->my_name, job->format) || !_export_reserve(&slot->names, 1))
+			return false;
+		_export_put(&slot->names, ",", 1);
+		if (!_export_put_name(&slot->names, match->op_name, job->format))
+			return false;
+
+		row_max = slot->names.len + 64;
+		if (!_export_reserve(&slot->out, row_max * match->count))
+			return false;
+
+		for (i = 0; i < match->count; i++) {
+			_export_put_uint(&slot->out, index);
+			_export_put(&slot->out, ",", 1);
+			_export_put_uint(&slot->out, i + 1);
+			_export_put(&slot->out, ",", 1);
+			_export_put(&slot->out, slot->names.data, slot->names.len);
+			if (match->ops[i].winner == KEY_TYPE_ME)
+				_export_put(&slot->out, ",me,\"", 5);
+			else
+				_export_put(&slot->out, ",op,\"", 5);
+			_export_put_score(&slot->out, &match->states[i]);
+			_export_put(&slot->out, "\"\n", 2);
+		}
+
+		return true;
+	}
+
+	/* One JSON object per line and per match */
+	if (!_export_reserve(&slot->out, 32))
+		return false;
+	_export_put(&slot->out, "{\"match\":", 9);
+	_export_put_uint(&slot->out, index);
+	_export_put(&slot->out, ",\"me\":", 6);
+	if (!_export_put_name(&slot->out, match->my_name, job->format) || !_export_reserve(&slot->out, 16))
+		return false;
+	_export_put(&slot->out, ",\"opponent\":", 12);
+	if (!_export_put_name(&slot->out, match->op_name, job->format))
+		return false;
+
+	row_max = 64;
+	if (!_export_reserve(&slot->out, row_max * match->count + 16))
+		return false;
+
+	_export_put(&slot->out, ",\"points\":[", 11);
+	for (i = 0; i < match->count; i++) {
+		if (i > 0)
+			_export_put(&slot->out, ",", 1);
+		if (match->ops[i].winner == KEY_TYPE_ME)
+			_export_put(&slot->out, "{\"winner\":\"me\",\"score\":\"", 24);
+		else
+			_export_put(&slot->out, "{\"winner\":\"op\",\"score\":\"", 24);
+		_export_put_score(&slot->out, &match->states[i]);
+		_export_put(&slot->out, "\"}", 2);
+	}
+	_export_put(&slot->out, "]}\n", 3);
+
+	return true;
+}
+
+/*
+ * @brief Writes a whole buffer to the output.
+ */
+static bool _export_write(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			dlog_print(DLOG_ERROR, LOG_TAG, "Failed to write export: %s", strerror(errno));
+			return false;
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+/*
+ * @brief Formats matches until every match of the export has been claimed.
+ */
+static void *_export_worker_run(void *data)
+{
+	struct export_job *job = data;
+
+	pthread_mutex_lock(&job->lock);
+	while (!job->failed && job->next < job->match_count) {
+		int index = job->next++;
+		struct export_slot *slot = &job->slots[index % job->slot_count];
+		bool ok;
+
+		/* The slot is free once the match that used it before has been written */
+		while (!job->failed && job->written + job->slot_count <= index)
+			pthread_cond_wait(&job->cond, &job->lock);
+		if (job->failed)
+			break;
+		pthread_mutex_unlock(&job->lock);
+
+		ok = _export_format_match(job, index, slot);
+
+		pthread_mutex_lock(&job->lock);
+		if (ok) {
+			slot->ready = index;
+		} else {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Failed to format match %d", index);
+			job->failed = true;
+		}
+		pthread_cond_broadcast(&job->cond);
+	}
+	pthread_mutex_unlock(&job->lock);
+
+	return NULL;
+}
+
+/*
+ * @brief Counts the points and the name bytes of one live match.
+ */
+static void _export_snapshot_count(match_handle handle, struct match *match, void *user_data)
+{
+	struct export_snapshot *snapshot = user_data;
+	const char *my_name = match_registry_string(snapshot->registry, match->my_name);
+	const char *op_name = match_registry_string(snapshot->registry, match->op_name);
+
+	snapshot->match_count++;
+	snapshot->points += match->log.count;
+	snapshot->names_len += (my_name ? strlen(my_name) : 0) + (op_name ? strlen(op_name) : 0) + 2;
+}
+
+/*
+ * @brief Copies a name into the name block of the snapshot.
+ */
+static const char *_export_snapshot_name(struct export_snapshot *snapshot, const char *name)
+{
+	char *copy = snapshot->names + snapshot->names_len;
+	size_t len = name ? strlen(name) : 0;
+
+	memcpy(copy, name ? name : "", len);
+	copy[len] = '\0';
+	snapshot->names_len += len + 1;
+
+	return copy;
+}
+
+/*
+ * @brief Copies the points and names of one live match.
+ */
+static void _export_snapshot_copy(match_handle handle, struct match *match, void *user_data)
+{
+	struct export_snapshot *snapshot = user_data;
+	struct export_match *copy = &snapshot->matches[snapshot->match_count++];
+	const struct point_log *log = &match->log;
+
+	copy->my_name = _export_snapshot_name(snapshot, match_registry_string(snapshot->registry, match->my_name));
+	copy->op_name = _export_snapshot_name(snapshot, match_registry_string(snapshot->registry, match->op_name));
+	copy->ops = snapshot->ops + snapshot->points;
+	copy->states = snapshot->states + snapshot->points;
+	copy->count = log->count;
+
+	memcpy(snapshot->ops + snapshot->points, log->ops, log->count * sizeof(*log->ops));
+	memcpy(snapshot->states + snapshot->points, log->states, log->count * sizeof(*log->states));
+	snapshot->points += log->count;
+}
+
+/*
+ * @brief Copies every live match of the registry in a few large blocks.
+ * Taking the snapshot only copies memory, so it can be done on the main
+ * loop, and the export itself then runs elsewhere. The registry is not
+ * saved across runs, so only the matches of the current run are copied.
+ * @param[in] registry The matches to export
+ * @return The snapshot, or NULL on failure
+ */
+struct export_snapshot *export_snapshot_create(const struct match_registry *registry)
+{
+	struct export_snapshot *snapshot = calloc(1, sizeof(*snapshot));
+
+	if (snapshot == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to allocate export snapshot");
+		return NULL;
+	}
+
+	snapshot->registry = registry;
+	match_registry_foreach(registry, _export_snapshot_count, snapshot);
+
+	snapshot->matches = malloc((snapshot->match_count ? snapshot->match_count : 1) * sizeof(*snapshot->matches));
+	snapshot->ops = malloc((snapshot->points ? snapshot->points : 1) * sizeof(*snapshot->ops));
+	snapshot->states = malloc((snapshot->points ? snapshot->points : 1) * sizeof(*snapshot->states));
+	snapshot->names = malloc(snapshot->names_len ? snapshot->names_len : 1);
+	if (snapshot->matches == NULL || snapshot->ops == NULL || snapshot->states == NULL || snapshot->names == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to allocate export snapshot");
+		export_snapshot_destroy(snapshot);
+		return NULL;
+	}
+
+	snapshot->match_count = 0;
+	snapshot->points = 0;
+	snapshot->names_len = 0;
+	match_registry_foreach(registry, _export_snapshot_copy, snapshot);
+	snapshot->registry = NULL;
+
+	return snapshot;
+}
+
+/*
+ * @brief Destroys a snapshot taken by export_snapshot_create().
+ */
+void export_snapshot_destroy(struct export_snapshot *snapshot)
+{
+	if (snapshot == NULL)
+		return;
+
+	free(snapshot->matches);
+	free(snapshot->ops);
+	free(snapshot->states);
+	free(snapshot->names);
+	free(snapshot);
+}
+
+/*
+ * @brief Streams the point-by-point score of every match of a snapshot to a file or pipe.
+ * Matches are formatted by 'threads' workers while the calling thread
+ * writes them out in registry order. The snapshot is only read, so this
+ * may run on any thread.
+ * @param[in] snapshot The matches to export
+ * @param[in] fd File descriptor the rows are written to
+ * @param[in] format CSV rows or one JSON object per match and line
+ * @param[in] threads Number of formatting workers
+ */
+bool export_snapshot_write(const struct export_snapshot *snapshot, int fd, export_format format, int threads)
+{
+	pthread_t tids[EXPORT_THREADS_MAX];
+	struct export_job job;
+	int started = 0;
+	int i;
+
+	pthread_once(&s_strings.once, _export_strings_init);
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > EXPORT_THREADS_MAX)
+		threads = EXPORT_THREADS_MAX;
+
+	memset(&job, 0, sizeof(job));
+	job.matches = snapshot->matches;
+	job.match_count = snapshot->match_count;
+	job.format = format;
+	job.slot_count = threads * EXPORT_SLOTS_PER_THREAD;
+
+	job.slots = calloc(job.slot_count, sizeof(*job.slots));
+	if (job.slots == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to allocate export");
+		return false;
+	}
+
+	for (i = 0; i < job.slot_count; i++)
+		job.slots[i].ready = -1;
+
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	if (format == EXPORT_FORMAT_CSV && !_export_write(fd, EXPORT_CSV_HEADER, strlen(EXPORT_CSV_HEADER)))
+		job.failed = true;
+
+	for (started = 0; started < threads && !job.failed; started++) {
+		if (pthread_create(&tids[started], NULL, _export_worker_run, &job) != 0)
+			break;
+	}
+
+	if (started == 0 && !job.failed) {
+		/* No worker could start, format on this thread instead */
+		for (i = 0; i < job.match_count && !job.failed; i++) {
+			if (!_export_format_match(&job, i, &job.slots[0]) ||
+					!_export_write(fd, job.slots[0].out.data, job.slots[0].out.len))
+				job.failed = true;
+		}
+	} else {
+		for (i = 0; i < job.match_count; i++) {
+			struct export_slot *slot = &job.slots[i % job.slot_count];
+
+			pthread_mutex_lock(&job.lock);
+			while (!job.failed && slot->ready != i)
+				pthread_cond_wait(&job.cond, &job.lock);
+			pthread_mutex_unlock(&job.lock);
+
+			if (job.failed)
+				break;
+
+			/* The slot is only reused once 'written' moves past it, so it is safe to write unlocked */
+			if (!_export_write(fd, slot->out.data, slot->out.len)) {
+				pthread_mutex_lock(&job.lock);
+				job.failed = true;
+				pthread_cond_broadcast(&job.cond);
+				pthread_mutex_unlock(&job.lock);
+				break;
+			}
+
+			pthread_mutex_lock(&job.lock);
+			job.written++;
+			pthread_cond_broadcast(&job.cond);
+			pthread_mutex_unlock(&job.lock);
+		}
+	}
+
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.lock);
+
+	for (i = 0; i < job.slot_count; i++) {
+		free(job.slots[i].out.data);
+		free(job.slots[i].names.data);
+	}
+	free(job.slots);
+
+	if (!job.failed)
+		dlog_print(DLOG_INFO, LOG_TAG, "exported %d matches", job.match_count);
+
+	return !job.failed;
+}
+
+/*
+ * @brief Streams the point-by-point score of every match to a file or pipe.
+ * Only the live matches of the registry are written, i.e. those scored
+ * since the application started and not retired since.
+ * The registry must not change until this returns, export_snapshot_create()
+ * lets the export run while it does.
+ * @param[in] registry The matches to export
+ * @param[in] fd File descriptor the rows are written to
+ * @param[in] format CSV rows or one JSON object per match and line
+ * @param[in] threads Number of formatting workers
+ */
+bool export_matches(const struct match_registry *registry, int fd, export_format format, int threads)
+{
+	struct export_snapshot *snapshot = export_snapshot_create(registry);
+	bool ret;
+
+	if (snapshot == NULL)
+		return false;
+
+	ret = export_snapshot_write(snapshot, fd, format, threads);
+	export_snapshot_destroy(snapshot);
+
+	return ret;
+}
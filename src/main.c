@@ -1,6 +1,41 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 #include <main.h>
 #include "view.h"
 #include "data.h"
+#include "match_registry.h"
+#include "startup_trace.h"
+#include "power.h"
+#include "export.h"
+
+#define EXPORT_PATH_KEY "export_path"
+#define EXPORT_FORMAT_KEY "export_format"
+#define EXPORT_RESULT_KEY "export_result"
+#define DEVICE_ID_KEY "device_id"
+#define MY_NAME_KEY "my_name"
+#define OP_NAME_KEY "op_name"
+
+/*
+ * An export running on an ecore thread, and the launch request it answers.
+ */
+struct export_request {
+	struct export_snapshot *snapshot;
+	app_control_h request;
+	int fd;
+	export_format format;
+	int threads;
+	bool ok;
+};
+
+static char edj_path[PATH_MAX] = { 0, };
+static Ecore_Idler *startup_idler = NULL;
+static unsigned int startup_step = 0;
+static bool startup_deferred = false;
+static bool paused = false;
+static bool scores_dirty = false;
 
 static button_score my_score_button = {
 		.button = NULL,
@@ -14,6 +49,35 @@ static button_score opponent_score_button = {
 		.button_name = "op_score_button"
 };
 
+/**
+ * @brief Displays the score of the match currently being scored.
+ * While the application is paused only the score is updated, and the
+ * display catches up in one go on resume.
+ */
+static void display_active_scores(void)
+{
+	if (paused) {
+		scores_dirty = true;
+		return;
+	}
+	scores_dirty = false;
+
+	struct score *my_score = NULL;
+	my_score = data_get_my_score();
+
+	struct score *op_score = NULL;
+	op_score = data_get_opponent_score();
+
+	/* No score to show once the active match has been retired */
+	if (my_score == NULL || op_score == NULL) {
+		view_clear_scores();
+		return;
+	}
+
+	view_display_my_scores(my_score->point_won, my_score->game_won, my_score->set_won);
+	view_display_op_scores(op_score->point_won, op_score->game_won, op_score->set_won);
+}
+
 /**
  * @brief Function will be called when the button is clicked determining
  * what kind of button is clicked.
@@ -37,13 +101,105 @@ static void button_clicked_cb(void *data, Evas_Object *obj, void *event_info)
 		break;
 	}
 
-	struct score *my_score = NULL;
-	my_score = data_get_my_score();
-	view_display_my_scores(my_score->point_won, my_score->game_won, my_score->set_won);
+	display_active_scores();
+}
 
-	struct score *op_score = NULL;
-	op_score = data_get_opponent_score();
-	view_display_op_scores(op_score->point_won, op_score->game_won, op_score->set_won);
+/**
+ * @brief Function will be called when a match is picked from the match list.
+ * @param[in] data Handle of the picked match, MATCH_HANDLE_INVALID to start a new one
+ * @param[in] obj The match list
+ * @param[in] event_info The selected item
+ */
+static void match_selected_cb(void *data, Evas_Object *obj, void *event_info)
+{
+	match_handle handle = *(match_handle *) data;
+
+	elm_genlist_item_selected_set((Elm_Object_Item *) event_info, EINA_FALSE);
+
+	if (handle == MATCH_HANDLE_INVALID)
+		handle = data_add_match(NULL, NULL);
+
+	if (!data_set_active_match(handle))
+		return;
+
+	view_show_match();
+	display_active_scores();
+}
+
+/**
+ * @brief Creates the theme used by the transparent score buttons.
+ */
+static void startup_create_theme(void)
+{
+	/* Initialize the new theme using EDJ file */
+	view_init_tennis_scores_theme(edj_path);
+}
+
+/**
+ * @brief Compiles the key moment rules, no moment is detected before.
+ */
+static void startup_compile_moments(void)
+{
+	if (!data_compile_moments())
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to compile the key moment rules");
+}
+
+/**
+ * @brief Creates each button for the app.
+ */
+static void startup_create_buttons(void)
+{
+	view_create_scores_button(&my_score_button, button_clicked_cb);
+	view_create_scores_button(&opponent_score_button, button_clicked_cb);
+
+	/* The match list is only built when the back key first asks for it */
+	view_create_match_list(match_selected_cb);
+}
+
+/**
+ * Parts of the UI that are not needed for the first frame.
+ * They are built one per idle iteration once the first frame is on screen.
+ */
+static const struct startup_step {
+	const char *name;
+	void (*run)(void);
+} startup_steps[] = {
+	{ "theme", startup_create_theme },
+	{ "buttons", startup_create_buttons },
+	{ "moments", startup_compile_moments },
+};
+
+/**
+ * @brief Builds the next deferred part of the UI.
+ * @param[in] data The user data to be passed to the callback function
+ */
+static Eina_Bool startup_step_idler_cb(void *data)
+{
+	startup_steps[startup_step].run();
+	startup_trace_mark(startup_steps[startup_step].name);
+
+	if (++startup_step < sizeof(startup_steps) / sizeof(startup_steps[0]))
+		return ECORE_CALLBACK_RENEW;
+
+	startup_idler = NULL;
+	startup_trace_end("ready");
+	return ECORE_CALLBACK_CANCEL;
+}
+
+/**
+ * @brief Function will be called once the first frame has been rendered.
+ * @param[in] data The user data to be passed to the callback function
+ * @param[in] e The canvas of the window
+ * @param[in] event_info The render event information
+ */
+static void startup_first_frame_cb(void *data, Evas *e, void *event_info)
+{
+	view_del_render_post_cb(startup_first_frame_cb);
+	startup_trace_mark("first_frame");
+
+	startup_deferred = true;
+	if (!paused)
+		startup_idler = ecore_idler_add(startup_step_idler_cb, NULL);
 }
 
 /**
@@ -55,33 +211,150 @@ static void button_clicked_cb(void *data, Evas_Object *obj, void *event_info)
  */
 static bool app_create(void *data)
 {
-	char file_path[PATH_MAX] = { 0, };
+	startup_trace_begin();
 
-	/* Get the path of EDJ file */
-	data_get_resource_path(EDJ_FILE, file_path, sizeof(file_path));
+	/* Create the match registry and the first match, the key moment rules wait for the first frame */
+	if (!data_initialize())
+		return false;
+	startup_trace_mark("data");
 
-	/* Initialize the new theme using EDJ file */
-	view_init_tennis_scores_theme(file_path);
+	/* Get the path of EDJ file, kept until the theme is finalized */
+	data_get_resource_path(EDJ_FILE, edj_path, sizeof(edj_path));
+	startup_trace_mark("resource_path");
 
 	/* Create window, conformant */
 	view_create();
+	startup_trace_mark("window");
 
 	/* Create specialized layout for the calculator using EDJ file */
-	view_create_tennis_scores_layout(file_path, GRP_MAIN);
+	view_create_tennis_scores_layout(edj_path, GRP_MAIN);
+	startup_trace_mark("layout");
 
-	/* Create label display the formula on the screen */
+	/* Create label display the points on the screen, the rest of the UI waits for the first frame */
 	view_create_my_points_label();
 	view_create_op_points_label();
+	startup_trace_mark("points_labels");
+
+	/* The games labels are part of the score, so they are on the first frame too */
 	view_create_my_scores_label();
 	view_create_op_scores_label();
+	startup_trace_mark("scores_labels");
 
-	/* Create each button for the app */
-	view_create_scores_button(&my_score_button, button_clicked_cb);
-	view_create_scores_button(&opponent_score_button, button_clicked_cb);
+	view_add_render_post_cb(startup_first_frame_cb, NULL);
 
 	return true;
 }
 
+/**
+ * @brief Writes the snapshot of an export, away from the main loop.
+ * @param[in] data The export request
+ * @param[in] thread The ecore thread
+ */
+static void export_thread_run(void *data, Ecore_Thread *thread)
+{
+	struct export_request *req = data;
+
+	req->ok = export_snapshot_write(req->snapshot, req->fd, req->format, req->threads);
+}
+
+/**
+ * @brief Releases an export and tells the application that asked for it how it went.
+ * @param[in] req The export request
+ * @param[in] ok Whether every match was written
+ */
+static void export_finish(struct export_request *req, bool ok)
+{
+	app_control_h reply = NULL;
+
+	close(req->fd);
+	export_snapshot_destroy(req->snapshot);
+
+	if (req->request && app_control_create(&reply) == APP_CONTROL_ERROR_NONE) {
+		app_control_add_extra_data(reply, EXPORT_RESULT_KEY, ok ? "ok" : "failed");
+		app_control_reply_to_launch_request(reply, req->request, ok ? APP_CONTROL_RESULT_SUCCEEDED : APP_CONTROL_RESULT_FAILED);
+		app_control_destroy(reply);
+	}
+	if (req->request)
+		app_control_destroy(req->request);
+
+	dlog_print(ok ? DLOG_INFO : DLOG_ERROR, LOG_TAG, "export %s", ok ? "finished" : "failed");
+	free(req);
+}
+
+/**
+ * @brief Function will be called on the main loop once the export has been written.
+ * @param[in] data The export request
+ * @param[in] thread The ecore thread
+ */
+static void export_thread_end(void *data, Ecore_Thread *thread)
+{
+	struct export_request *req = data;
+
+	export_finish(req, req->ok);
+}
+
+/**
+ * @brief Function will be called on the main loop if the export thread was cancelled or could not start.
+ * @param[in] data The export request
+ * @param[in] thread The ecore thread
+ */
+static void export_thread_cancel(void *data, Ecore_Thread *thread)
+{
+	export_finish(data, false);
+}
+
+/**
+ * @brief Starts exporting every match to a file.
+ * Matches are only kept in memory, so the file holds the matches scored
+ * since the application was launched, not earlier ones.
+ * The matches are copied on the main loop and written on an ecore thread,
+ * so scoring goes on while a long history is exported. The launch request
+ * is answered once the file is complete.
+ * @param[in] app_control The launch request that asked for the export
+ * @param[in] path Path of the file to write
+ * @param[in] format Format of the file
+ */
+static void export_start(app_control_h app_control, const char *path, export_format format)
+{
+	struct export_request *req;
+	long cpus;
+
+	req = calloc(1, sizeof(*req));
+	if (req == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to start export");
+		return;
+	}
+
+	req->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (req->fd < 0) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to open %s", path);
+		free(req);
+		return;
+	}
+
+	req->snapshot = export_snapshot_create(data_get_registry());
+	if (req->snapshot == NULL) {
+		close(req->fd);
+		free(req);
+		return;
+	}
+
+	/* sysconf() returns -1 when the count is unknown */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	if (cpus > EXPORT_THREADS_MAX)
+		cpus = EXPORT_THREADS_MAX;
+
+	req->format = format;
+	req->threads = (int)cpus;
+	if (app_control_clone(&req->request, app_control) != APP_CONTROL_ERROR_NONE)
+		req->request = NULL;
+
+	/* If the thread cannot start, the cancel callback has already released the request */
+	ecore_thread_run(export_thread_run, export_thread_end, export_thread_cancel, req);
+}
+
 /**
  * @brief This callback function is called when another application.
  * @param[in] app_control The handle to the app_control
@@ -91,6 +364,51 @@ static bool app_create(void *data)
 static void app_control(app_control_h app_control, void *data)
 {
 	/* Handle the launch request. */
+	char *export_path = NULL;
+	char *format_name = NULL;
+	char *device_id = NULL;
+	char *my_name = NULL;
+	char *op_name = NULL;
+	export_format format = EXPORT_FORMAT_CSV;
+
+	/* The chair umpire's watch is given a low id, so its version of a disputed point is kept */
+	if (app_control_get_extra_data(app_control, DEVICE_ID_KEY, &device_id) == APP_CONTROL_ERROR_NONE) {
+		char *end = NULL;
+		unsigned long long id;
+
+		errno = 0;
+		id = strtoull(device_id, &end, 10);
+		/* strtoull() would take leading blanks and a minus sign */
+		if (!isdigit((unsigned char)device_id[0]) || errno || *end != '\0' || id > UINT_MAX)
+			dlog_print(DLOG_ERROR, LOG_TAG, "Ignoring invalid device id \"%s\"", device_id);
+		else
+			data_set_device_id((unsigned int)id);
+		free(device_id);
+	}
+
+	/* Players are rated by name, the launcher names the opponent of the next match */
+	if (app_control_get_extra_data(app_control, MY_NAME_KEY, &my_name) != APP_CONTROL_ERROR_NONE)
+		my_name = NULL;
+	if (app_control_get_extra_data(app_control, OP_NAME_KEY, &op_name) != APP_CONTROL_ERROR_NONE)
+		op_name = NULL;
+	if (my_name || op_name) {
+		data_set_player_names(my_name, op_name);
+		free(my_name);
+		free(op_name);
+	}
+
+	/* Export the matches of this run when asked for with an "export_path" extra */
+	if (app_control_get_extra_data(app_control, EXPORT_PATH_KEY, &export_path) != APP_CONTROL_ERROR_NONE)
+		return;
+
+	if (app_control_get_extra_data(app_control, EXPORT_FORMAT_KEY, &format_name) == APP_CONTROL_ERROR_NONE) {
+		if (!strcmp(format_name, "json"))
+			format = EXPORT_FORMAT_JSON;
+		free(format_name);
+	}
+
+	export_start(app_control, export_path, format);
+	free(export_path);
 }
 
 /**
@@ -102,6 +420,16 @@ static void app_control(app_control_h app_control, void *data)
 static void app_pause(void *data)
 {
 	/* Take necessary actions when application becomes invisible. */
+	power_pause_begin();
+	paused = true;
+
+	/* The rest of the startup waits, it would only wake the paused application up */
+	if (startup_idler) {
+		ecore_idler_del(startup_idler);
+		startup_idler = NULL;
+	}
+
+	view_pause();
 }
 
 /**
@@ -112,6 +440,17 @@ static void app_pause(void *data)
 static void app_resume(void *data)
 {
 	/* Take necessary actions when application becomes visible. */
+	view_resume();
+	paused = false;
+
+	/* Points scored while paused are displayed in a single render */
+	if (scores_dirty)
+		display_active_scores();
+
+	if (startup_deferred && startup_idler == NULL && startup_step < sizeof(startup_steps) / sizeof(startup_steps[0]))
+		startup_idler = ecore_idler_add(startup_step_idler_cb, NULL);
+
+	power_pause_end();
 }
 
 /**
@@ -121,16 +460,19 @@ static void app_resume(void *data)
 static void app_terminate(void *data)
 {
 	/* Release all resources. */
-	char file_path[PATH_MAX] = {0, };
-
-	/* Get the EDJ file path */
-	data_get_resource_path(EDJ_FILE, file_path, sizeof(file_path));
+	if (startup_idler) {
+		ecore_idler_del(startup_idler);
+		startup_idler = NULL;
+	}
 
 	/* Finalize the theme using EDJ file */
-	view_fini_tennis_scores_theme(file_path);
+	view_fini_tennis_scores_theme(edj_path);
 
 	/* Destroy the window */
 	view_destroy();
+
+	/* Release every match */
+	data_finalize();
 }
 
 /**
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+#include <dlog.h>
+#include <main.h>
+#include "match_registry.h"
+
+#define MATCH_SLAB_SHIFT 8
+#define MATCH_SLAB_SIZE (1 << MATCH_SLAB_SHIFT)
+#define MATCH_SLAB_MASK (MATCH_SLAB_SIZE - 1)
+
+/*
+ * Matches live in fixed-size slabs that are never freed or moved while the
+ * registry exists. Retired slots go on a free list and keep their point log
+ * and moment checkpoint buffers, so a long-running registry stops allocating
+ * once it is warm.
+ */
+struct match_registry {
+	struct match **slabs;
+	int slab_count;
+	int slab_capacity;
+	int slot_count;
+	int free_head;
+	int live;
+	long long created;
+	long long retired;
+	struct string_pool *strings;
+};
+
+/*
+ * @brief Gets the match stored in a slot.
+ */
+static struct match *_match_registry_slot(const struct match_registry *registry, int index)
+{
+	return &registry->slabs[index >> MATCH_SLAB_SHIFT][index & MATCH_SLAB_MASK];
+}
+
+/*
+ * @brief Adds a new slab of free slots to the registry.
+ */
+static bool _match_registry_grow(struct match_registry *registry)
+{
+	struct match *slab;
+	int i;
+
+	if (registry->slab_count == registry->slab_capacity) {
+		int capacity = registry->slab_capacity ? registry->slab_capacity * 2 : 4;
+		struct match **slabs = realloc(registry->slabs, capacity * sizeof(*slabs));
+
+		if (slabs == NULL)
+			return false;
+
+		registry->slabs = slabs;
+		registry->slab_capacity = capacity;
+	}
+
+	slab = calloc(MATCH_SLAB_SIZE, sizeof(*slab));
+	if (slab == NULL)
+		return false;
+
+	registry->slabs[registry->slab_count++] = slab;
+
+	/* Chain the new slots in order so they are handed out front to back */
+	for (i = 0; i < MATCH_SLAB_SIZE; i++) {
+		slab[i].generation = 1;
+		slab[i].next_free = i + 1 < MATCH_SLAB_SIZE ? registry->slot_count + i + 1 : registry->free_head;
+	}
+
+	registry->free_head = registry->slot_count;
+	registry->slot_count += MATCH_SLAB_SIZE;
+
+	return true;
+}
+
+/*
+ * @brief Creates an empty match registry.
+ */
+struct match_registry *match_registry_create(void)
+{
+	struct match_registry *registry = calloc(1, sizeof(*registry));
+
+	if (registry == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create match registry");
+		return NULL;
+	}
+
+	registry->free_head = -1;
+
+	registry->strings = string_pool_create();
+	if (registry->strings == NULL) {
+		free(registry);
+		return NULL;
+	}
+
+	return registry;
+}
+
+/*
+ * @brief Destroys the registry, every match in it and the interned strings.
+ */
+void match_registry_destroy(struct match_registry *registry)
+{
+	int i;
+
+	if (registry == NULL)
+		return;
+
+	for (i = 0; i < registry->slot_count; i++) {
+		point_log_fini(&_match_registry_slot(registry, i)->log);
+		moment_history_fini(&_match_registry_slot(registry, i)->moment_checkpoints);
+	}
+
+	for (i = 0; i < registry->slab_count; i++)
+		free(registry->slabs[i]);
+
+	free(registry->slabs);
+	string_pool_destroy(registry->strings);
+	free(registry);
+}
+
+/*
+ * @brief Creates a new match.
+ * @param[in] registry The match registry
+ * @param[in] my_name Name of the player scoring on this device
+ * @param[in] op_name Name of the opponent
+ * @return Handle of the match, or MATCH_HANDLE_INVALID on failure
+ */
+match_handle match_registry_add(struct match_registry *registry, const char *my_name, const char *op_name)
+{
+	struct match *match;
+	string_id my_id;
+	string_id op_id;
+	int index;
+
+	my_id = string_pool_intern(registry->strings, my_name);
+	op_id = string_pool_intern(registry->strings, op_name);
+	if (my_id == 0 || op_id == 0 || (registry->free_head < 0 && !_match_registry_grow(registry))) {
+		/* Releasing id 0 does nothing */
+		string_pool_release(registry->strings, my_id);
+		string_pool_release(registry->strings, op_id);
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to add match");
+		return MATCH_HANDLE_INVALID;
+	}
+
+	index = registry->free_head;
+	match = _match_registry_slot(registry, index);
+	registry->free_head = match->next_free;
+
+	memset(&match->score, 0, sizeof(match->score));
+	point_log_reset(&match->log);
+	moment_stream_init(&match->moments);
+	moment_history_reset(&match->moment_checkpoints);
+	pace_series_init(&match->pace);
+	match->my_name = my_id;
+	match->op_name = op_id;
+	match->next_free = -1;
+	match->live = true;
+	match->finished = false;
+	match->win_points = 0;
+	memset(&match->result, 0, sizeof(match->result));
+	match->similar_item = -1;
+
+	registry->live++;
+	registry->created++;
+
+	return ((match_handle)match->generation << 32) | (unsigned int)index;
+}
+
+/*
+ * @brief Gives a match new player names.
+ * @param[in] registry The match registry
+ * @param[in] handle Handle of the match
+ * @param[in] my_name Name of the player scoring on this device
+ * @param[in] op_name Name of the opponent
+ * @return false if the handle is stale or a name cannot be interned, the old names are then kept
+ */
+bool match_registry_rename(struct match_registry *registry, match_handle handle, const char *my_name, const char *op_name)
+{
+	struct match *match = match_registry_get(registry, handle);
+	string_id my_id;
+	string_id op_id;
+
+	if (match == NULL)
+		return false;
+
+	my_id = string_pool_intern(registry->strings, my_name);
+	op_id = string_pool_intern(registry->strings, op_name);
+	if (my_id == 0 || op_id == 0) {
+		string_pool_release(registry->strings, my_id);
+		string_pool_release(registry->strings, op_id);
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to rename match");
+		return false;
+	}
+
+	string_pool_release(registry->strings, match->my_name);
+	string_pool_release(registry->strings, match->op_name);
+	match->my_name = my_id;
+	match->op_name = op_id;
+
+	return true;
+}
+
+/*
+ * @brief Looks up a match by its handle.
+ * @return The match, or NULL if the handle is stale or invalid
+ */
+struct match *match_registry_get(const struct match_registry *registry, match_handle handle)
+{
+	unsigned int index = (unsigned int)handle;
+	struct match *match;
+
+	if (index >= (unsigned int)registry->slot_count)
+		return NULL;
+
+	match = _match_registry_slot(registry, index);
+	if (!match->live || match->generation != (unsigned int)(handle >> 32))
+		return NULL;
+
+	return match;
+}
+
+/*
+ * @brief Retires a match and recycles its slot.
+ * @return false if the handle is stale or invalid
+ */
+bool match_registry_retire(struct match_registry *registry, match_handle handle)
+{
+	struct match *match = match_registry_get(registry, handle);
+
+	if (match == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to retire match: stale handle");
+		return false;
+	}
+
+	match->live = false;
+	string_pool_release(registry->strings, match->my_name);
+	string_pool_release(registry->strings, match->op_name);
+	match->my_name = 0;
+	match->op_name = 0;
+	/* Generation 0 is skipped so that no live handle is ever 0 */
+	if (++match->generation == 0)
+		match->generation = 1;
+	match->next_free = registry->free_head;
+	registry->free_head = (unsigned int)handle;
+
+	registry->live--;
+	registry->retired++;
+
+	return true;
+}
+
+/*
+ * @brief Calls 'cb' for every live match in slot order.
+ */
+void match_registry_foreach(const struct match_registry *registry, match_registry_foreach_cb cb, void *user_data)
+{
+	int i;
+
+	for (i = 0; i < registry->slot_count; i++) {
+		struct match *match = _match_registry_slot(registry, i);
+
+		if (match->live)
+			cb(((match_handle)match->generation << 32) | (unsigned int)i, match, user_data);
+	}
+}
+
+/*
+ * @brief Interns a player or event name in the registry string table.
+ * The name stays interned until match_registry_release_name is called for it.
+ */
+string_id match_registry_intern(struct match_registry *registry, const char *str)
+{
+	return string_pool_intern(registry->strings, str);
+}
+
+/*
+ * @brief Keeps a name interned after the matches that use it are retired.
+ */
+void match_registry_retain_name(struct match_registry *registry, string_id id)
+{
+	string_pool_retain(registry->strings, id);
+}
+
+/*
+ * @brief Gives back a name taken with match_registry_intern or match_registry_retain_name.
+ */
+void match_registry_release_name(struct match_registry *registry, string_id id)
+{
+	string_pool_release(registry->strings, id);
+}
+
+/*
+ * @brief Gets a name interned in the registry string table.
+ */
+const char *match_registry_string(const struct match_registry *registry, string_id id)
+{
+	return string_pool_get(registry->strings, id);
+}
+
+/*
+ * @brief Gets the counters of the registry.
+ * @param[in] registry The match registry
+ * @param[out] stats_out Counters of the registry
+ */
+void match_registry_get_stats(const struct match_registry *registry, struct match_registry_stats *stats_out)
+{
+	stats_out->live = registry->live;
+	stats_out->slots = registry->slot_count;
+	stats_out->slabs = registry->slab_count;
+	stats_out->created = registry->created;
+	stats_out->retired = registry->retired;
+	stats_out->strings = string_pool_count(registry->strings);
+}
@@ -0,0 +1,693 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dlog.h>
+#include <main.h>
+#include "data.h"
+#include "moment.h"
+
+#define MOMENT_NAME_MAX 32
+#define MOMENT_TERMS_MAX 31
+#define MOMENT_PREDICATES_MAX 6
+#define MOMENT_ALTERNATIVES_MAX 4
+#define MOMENT_DFA_MAX 255
+#define MOMENT_SYMBOLS(pred_count) (1 << (pred_count))
+
+typedef enum {
+	MOMENT_ATOM_ME = 1 << 0,
+	MOMENT_ATOM_OP = 1 << 1,
+	MOMENT_ATOM_GAME_ME = 1 << 2,
+	MOMENT_ATOM_GAME_OP = 1 << 3,
+	MOMENT_ATOM_SET_ME = 1 << 4,
+	MOMENT_ATOM_SET_OP = 1 << 5,
+	MOMENT_ATOM_MATCH_ME = 1 << 6,
+	MOMENT_ATOM_MATCH_OP = 1 << 7,
+	MOMENT_ATOM_SRV_ME = 1 << 8,
+	MOMENT_ATOM_SRV_OP = 1 << 9,
+	MOMENT_ATOM_GP_ME = 1 << 10,
+	MOMENT_ATOM_GP_OP = 1 << 11,
+	MOMENT_ATOM_BP_ME = 1 << 12,
+	MOMENT_ATOM_BP_OP = 1 << 13,
+	MOMENT_ATOM_SP_ME = 1 << 14,
+	MOMENT_ATOM_SP_OP = 1 << 15,
+	MOMENT_ATOM_MP_ME = 1 << 16,
+	MOMENT_ATOM_MP_OP = 1 << 17,
+	MOMENT_ATOM_SFS_ME = 1 << 18,
+	MOMENT_ATOM_SFS_OP = 1 << 19,
+	MOMENT_ATOM_TRAIL_ME = 1 << 20,
+	MOMENT_ATOM_TRAIL_OP = 1 << 21,
+	MOMENT_ATOM_TRAIL2_ME = 1 << 22,
+	MOMENT_ATOM_TRAIL2_OP = 1 << 23,
+	MOMENT_ATOM_LEVEL = 1 << 24,
+} moment_atom;
+
+static const struct {
+	const char *name;
+	moment_atom atom;
+} moment_atoms[] = {
+	{ "me", MOMENT_ATOM_ME },
+	{ "op", MOMENT_ATOM_OP },
+	{ "game_me", MOMENT_ATOM_GAME_ME },
+	{ "game_op", MOMENT_ATOM_GAME_OP },
+	{ "set_me", MOMENT_ATOM_SET_ME },
+	{ "set_op", MOMENT_ATOM_SET_OP },
+	{ "match_me", MOMENT_ATOM_MATCH_ME },
+	{ "match_op", MOMENT_ATOM_MATCH_OP },
+	{ "srv_me", MOMENT_ATOM_SRV_ME },
+	{ "srv_op", MOMENT_ATOM_SRV_OP },
+	{ "gp_me", MOMENT_ATOM_GP_ME },
+	{ "gp_op", MOMENT_ATOM_GP_OP },
+	{ "bp_me", MOMENT_ATOM_BP_ME },
+	{ "bp_op", MOMENT_ATOM_BP_OP },
+	{ "sp_me", MOMENT_ATOM_SP_ME },
+	{ "sp_op", MOMENT_ATOM_SP_OP },
+	{ "mp_me", MOMENT_ATOM_MP_ME },
+	{ "mp_op", MOMENT_ATOM_MP_OP },
+	{ "sfs_me", MOMENT_ATOM_SFS_ME },
+	{ "sfs_op", MOMENT_ATOM_SFS_OP },
+	{ "trail_me", MOMENT_ATOM_TRAIL_ME },
+	{ "trail_op", MOMENT_ATOM_TRAIL_OP },
+	{ "trail2_me", MOMENT_ATOM_TRAIL2_ME },
+	{ "trail2_op", MOMENT_ATOM_TRAIL2_OP },
+	{ "level", MOMENT_ATOM_LEVEL },
+};
+
+typedef enum {
+	MOMENT_TERM_ONE = 0,
+	MOMENT_TERM_OPTIONAL = 1,
+	MOMENT_TERM_STAR = 2,
+} moment_term_kind;
+
+/*
+ * A predicate holds when any of its alternatives holds, and an
+ * alternative holds when all 'want' atoms are set and no 'forbid' atom is.
+ */
+struct moment_predicate {
+	unsigned int want[MOMENT_ALTERNATIVES_MAX];
+	unsigned int forbid[MOMENT_ALTERNATIVES_MAX];
+	int count;
+};
+
+/*
+ * A rule compiled to a DFA. The input symbol of a point has one bit per
+ * distinct predicate of the rule, so the table stays small however many
+ * atoms the language has.
+ */
+struct moment_rule {
+	char name[MOMENT_NAME_MAX];
+	struct moment_predicate predicates[MOMENT_PREDICATES_MAX];
+	int predicate_count;
+	int dfa_count;
+	unsigned char *next;
+	unsigned char *accept;
+};
+
+struct moment_rules {
+	struct moment_rule rules[MOMENT_RULES_MAX];
+	int count;
+};
+
+/*
+ * Terms of a rule being compiled. NFA state i means the first i terms
+ * have matched; term i moves from state i to state i + 1.
+ */
+struct moment_pattern {
+	int predicate[MOMENT_TERMS_MAX];
+	moment_term_kind kind[MOMENT_TERMS_MAX];
+	int count;
+};
+
+/*
+ * @brief Looks up an atom by name.
+ * @return The atom, or 0 if the name is unknown
+ */
+static unsigned int _moment_atom_find(const char *name, size_t len)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(moment_atoms) / sizeof(moment_atoms[0]); i++) {
+		if (strlen(moment_atoms[i].name) == len && !strncmp(moment_atoms[i].name, name, len))
+			return moment_atoms[i].atom;
+	}
+
+	return 0;
+}
+
+/*
+ * @brief Parses a predicate such as "game_me&sfs_me|game_op&sfs_me".
+ */
+static bool _moment_parse_predicate(const char *text, size_t len, struct moment_predicate *pred)
+{
+	size_t pos = 0;
+
+	memset(pred, 0, sizeof(*pred));
+
+	/* '.' is an alternative with no condition */
+	if (len == 1 && text[0] == '.') {
+		pred->count = 1;
+		return true;
+	}
+
+	pred->count = 1;
+	while (pos < len) {
+		bool negate = false;
+		unsigned int atom;
+		size_t start;
+
+		if (text[pos] == '!') {
+			negate = true;
+			pos++;
+		}
+
+		start = pos;
+		while (pos < len && text[pos] != '&' && text[pos] != '|')
+			pos++;
+
+		atom = _moment_atom_find(text + start, pos - start);
+		if (atom == 0)
+			return false;
+
+		if (negate)
+			pred->forbid[pred->count - 1] |= atom;
+		else
+			pred->want[pred->count - 1] |= atom;
+
+		if (pos < len && text[pos] == '|') {
+			if (pred->count == MOMENT_ALTERNATIVES_MAX)
+				return false;
+			pred->count++;
+		}
+
+		if (pos < len)
+			pos++;
+	}
+
+	return true;
+}
+
+/*
+ * @brief Finds or adds a predicate of the rule.
+ * @return Index of the predicate, or -1 if the rule has too many
+ */
+static int _moment_rule_add_predicate(struct moment_rule *rule, const struct moment_predicate *pred)
+{
+	int i;
+
+	for (i = 0; i < rule->predicate_count; i++) {
+		if (!memcmp(&rule->predicates[i], pred, sizeof(*pred)))
+			return i;
+	}
+
+	if (rule->predicate_count == MOMENT_PREDICATES_MAX)
+		return -1;
+
+	rule->predicates[rule->predicate_count] = *pred;
+	return rule->predicate_count++;
+}
+
+/*
+ * @brief Adds a term to the pattern of a rule.
+ */
+static bool _moment_pattern_add(struct moment_pattern *pattern, int predicate, moment_term_kind kind)
+{
+	if (pattern->count == MOMENT_TERMS_MAX)
+		return false;
+
+	pattern->predicate[pattern->count] = predicate;
+	pattern->kind[pattern->count] = kind;
+	pattern->count++;
+
+	return true;
+}
+
+/*
+ * @brief Parses the terms of a rule.
+ */
+static bool _moment_parse_pattern(const char *text, size_t len, struct moment_rule *rule, struct moment_pattern *pattern)
+{
+	size_t pos = 0;
+
+	while (pos < len) {
+		struct moment_predicate pred;
+		size_t start;
+		size_t pred_len;
+		int index;
+		int repeat = 1;
+		char quantifier;
+		int i;
+
+		while (pos < len && isspace((unsigned char)text[pos]))
+			pos++;
+		if (pos == len)
+			break;
+
+		start = pos;
+		while (pos < len && !isspace((unsigned char)text[pos]))
+			pos++;
+
+		/* Split the quantifier off the predicate */
+		pred_len = pos - start;
+		quantifier = '\0';
+		if (pred_len > 1 && strchr("*+?", text[pos - 1])) {
+			quantifier = text[pos - 1];
+			pred_len--;
+		} else if (pred_len > 1 && text[pos - 1] == '}') {
+			const char *brace = memchr(text + start, '{', pred_len);
+
+			if (brace == NULL)
+				return false;
+			repeat = atoi(brace + 1);
+			if (repeat < 1)
+				return false;
+			pred_len = brace - (text + start);
+		}
+
+		if (!_moment_parse_predicate(text + start, pred_len, &pred))
+			return false;
+
+		index = _moment_rule_add_predicate(rule, &pred);
+		if (index < 0)
+			return false;
+
+		switch (quantifier) {
+		case '*':
+			if (!_moment_pattern_add(pattern, index, MOMENT_TERM_STAR))
+				return false;
+			break;
+		case '+':
+			if (!_moment_pattern_add(pattern, index, MOMENT_TERM_ONE) ||
+					!_moment_pattern_add(pattern, index, MOMENT_TERM_STAR))
+				return false;
+			break;
+		case '?':
+			if (!_moment_pattern_add(pattern, index, MOMENT_TERM_OPTIONAL))
+				return false;
+			break;
+		default:
+			for (i = 0; i < repeat; i++) {
+				if (!_moment_pattern_add(pattern, index, MOMENT_TERM_ONE))
+					return false;
+			}
+			break;
+		}
+	}
+
+	return pattern->count > 0;
+}
+
+/*
+ * @brief Adds the NFA states reachable without consuming a point.
+ */
+static unsigned int _moment_nfa_closure(const struct moment_pattern *pattern, unsigned int set)
+{
+	int i;
+
+	for (i = 0; i < pattern->count; i++) {
+		if ((set & (1u << i)) && pattern->kind[i] != MOMENT_TERM_ONE)
+			set |= 1u << (i + 1);
+	}
+
+	return set;
+}
+
+/*
+ * @brief Gets the NFA states reached from 'set' by a point with the given symbol.
+ */
+static unsigned int _moment_nfa_move(const struct moment_pattern *pattern, unsigned int set, unsigned int symbol)
+{
+	/* State 0 loops on every point, so a match may start anywhere in the stream */
+	unsigned int next = 1;
+	int i;
+
+	for (i = 0; i < pattern->count; i++) {
+		if (!(set & (1u << i)) || !(symbol & (1u << pattern->predicate[i])))
+			continue;
+
+		if (pattern->kind[i] == MOMENT_TERM_STAR)
+			next |= 1u << i;
+		else
+			next |= 1u << (i + 1);
+	}
+
+	return _moment_nfa_closure(pattern, next);
+}
+
+/*
+ * @brief Builds the DFA of a rule from its pattern by subset construction.
+ */
+static bool _moment_rule_build(struct moment_rule *rule, const struct moment_pattern *pattern)
+{
+	unsigned int sets[MOMENT_DFA_MAX];
+	unsigned int accept_bit = 1u << pattern->count;
+	int symbols = MOMENT_SYMBOLS(rule->predicate_count);
+	int state;
+
+	rule->next = malloc(MOMENT_DFA_MAX * symbols);
+	rule->accept = malloc(MOMENT_DFA_MAX);
+	if (rule->next == NULL || rule->accept == NULL)
+		return false;
+
+	sets[0] = _moment_nfa_closure(pattern, 1);
+	rule->dfa_count = 1;
+
+	for (state = 0; state < rule->dfa_count; state++) {
+		int symbol;
+
+		rule->accept[state] = (sets[state] & accept_bit) != 0;
+
+		for (symbol = 0; symbol < symbols; symbol++) {
+			unsigned int next = _moment_nfa_move(pattern, sets[state], symbol);
+			int found;
+
+			for (found = 0; found < rule->dfa_count; found++) {
+				if (sets[found] == next)
+					break;
+			}
+
+			if (found == rule->dfa_count) {
+				if (rule->dfa_count == MOMENT_DFA_MAX)
+					return false;
+				sets[rule->dfa_count++] = next;
+			}
+
+			rule->next[state * symbols + symbol] = found;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * @brief Compiles one "name: pattern" line into a rule.
+ */
+static bool _moment_rule_compile(struct moment_rule *rule, const char *line, size_t len)
+{
+	struct moment_pattern pattern;
+	const char *colon = memchr(line, ':', len);
+	size_t name_len;
+
+	memset(&pattern, 0, sizeof(pattern));
+	if (colon == NULL)
+		return false;
+
+	name_len = colon - line;
+	if (name_len == 0 || name_len >= MOMENT_NAME_MAX)
+		return false;
+
+	memcpy(rule->name, line, name_len);
+	rule->name[name_len] = '\0';
+
+	if (!_moment_parse_pattern(colon + 1, len - name_len - 1, rule, &pattern))
+		return false;
+
+	return _moment_rule_build(rule, &pattern);
+}
+
+/*
+ * @brief Compiles rules describing key moments.
+ * @param[in] source Rules, one per line, see moment.h
+ * @return The compiled rules, or NULL if a rule is invalid
+ */
+struct moment_rules *moment_rules_compile(const char *source)
+{
+	struct moment_rules *rules = calloc(1, sizeof(*rules));
+	const char *line = source;
+
+	if (rules == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to allocate moment rules");
+		return NULL;
+	}
+
+	while (*line) {
+		const char *end = strchr(line, '\n');
+		size_t len = end ? (size_t)(end - line) : strlen(line);
+
+		if (len > 0) {
+			if (rules->count == MOMENT_RULES_MAX ||
+					!_moment_rule_compile(&rules->rules[rules->count], line, len)) {
+				dlog_print(DLOG_ERROR, LOG_TAG, "Invalid moment rule: %.*s", (int)len, line);
+				rules->count++;
+				moment_rules_destroy(rules);
+				return NULL;
+			}
+			rules->count++;
+		}
+
+		line += len;
+		if (*line == '\n')
+			line++;
+	}
+
+	return rules;
+}
+
+/*
+ * @brief Destroys compiled rules.
+ */
+void moment_rules_destroy(struct moment_rules *rules)
+{
+	int i;
+
+	if (rules == NULL)
+		return;
+
+	for (i = 0; i < rules->count && i < MOMENT_RULES_MAX; i++) {
+		free(rules->rules[i].next);
+		free(rules->rules[i].accept);
+	}
+
+	free(rules);
+}
+
+/*
+ * @brief Gets the number of compiled rules.
+ */
+int moment_rules_count(const struct moment_rules *rules)
+{
+	return rules->count;
+}
+
+/*
+ * @brief Gets the name of a rule, its bit in moment_stream_feed() results is 1 << index.
+ */
+const char *moment_rules_name(const struct moment_rules *rules, int index)
+{
+	if (index < 0 || index >= rules->count)
+		return NULL;
+
+	return rules->rules[index].name;
+}
+
+/*
+ * @brief Resets the detector state of a match.
+ */
+void moment_stream_init(struct moment_stream *stream)
+{
+	memset(stream, 0, sizeof(*stream));
+}
+
+/*
+ * @brief Computes the atoms that hold after a point.
+ */
+static unsigned int _moment_atoms(key_type winner, const struct match_score *after, unsigned int games_played)
+{
+	const struct score *my = &after->my;
+	const struct score *op = &after->op;
+	unsigned int atoms = 0;
+	bool srv_me = (games_played & 1) == 0;
+
+	if (winner == KEY_TYPE_ME) {
+		atoms |= MOMENT_ATOM_ME;
+		/* Only the side that won the game has its points reset */
+		if (my->point_won == POINT_LOVE)
+			atoms |= MOMENT_ATOM_GAME_ME;
+		if ((atoms & MOMENT_ATOM_GAME_ME) && my->game_won == GAME_ZERO)
+			atoms |= MOMENT_ATOM_SET_ME;
+		if ((atoms & MOMENT_ATOM_SET_ME) && my->set_won == SET_ZERO)
+			atoms |= MOMENT_ATOM_MATCH_ME;
+	} else {
+		atoms |= MOMENT_ATOM_OP;
+		if (op->point_won == POINT_LOVE)
+			atoms |= MOMENT_ATOM_GAME_OP;
+		if ((atoms & MOMENT_ATOM_GAME_OP) && op->game_won == GAME_ZERO)
+			atoms |= MOMENT_ATOM_SET_OP;
+		if ((atoms & MOMENT_ATOM_SET_OP) && op->set_won == SET_ZERO)
+			atoms |= MOMENT_ATOM_MATCH_OP;
+	}
+
+	atoms |= srv_me ? MOMENT_ATOM_SRV_ME : MOMENT_ATOM_SRV_OP;
+
+	if (my->point_won == POINT_40) {
+		atoms |= MOMENT_ATOM_GP_ME;
+		if (!srv_me)
+			atoms |= MOMENT_ATOM_BP_ME;
+		if (my->game_won == GAME_FIVE) {
+			atoms |= MOMENT_ATOM_SP_ME;
+			if (my->set_won == SET_TWO)
+				atoms |= MOMENT_ATOM_MP_ME;
+		}
+	}
+
+	if (op->point_won == POINT_40) {
+		atoms |= MOMENT_ATOM_GP_OP;
+		if (srv_me)
+			atoms |= MOMENT_ATOM_BP_OP;
+		if (op->game_won == GAME_FIVE) {
+			atoms |= MOMENT_ATOM_SP_OP;
+			if (op->set_won == SET_TWO)
+				atoms |= MOMENT_ATOM_MP_OP;
+		}
+	}
+
+	if (srv_me && my->game_won == GAME_FIVE)
+		atoms |= MOMENT_ATOM_SFS_ME;
+	if (!srv_me && op->game_won == GAME_FIVE)
+		atoms |= MOMENT_ATOM_SFS_OP;
+
+	if (my->set_won < op->set_won || (my->set_won == op->set_won && my->game_won < op->game_won))
+		atoms |= MOMENT_ATOM_TRAIL_ME;
+	if (op->set_won < my->set_won || (op->set_won == my->set_won && op->game_won < my->game_won))
+		atoms |= MOMENT_ATOM_TRAIL_OP;
+	if (my->set_won < op->set_won || (my->set_won == op->set_won && my->game_won + 2 <= op->game_won))
+		atoms |= MOMENT_ATOM_TRAIL2_ME;
+	if (op->set_won < my->set_won || (op->set_won == my->set_won && op->game_won + 2 <= my->game_won))
+		atoms |= MOMENT_ATOM_TRAIL2_OP;
+	if (my->set_won == op->set_won && my->game_won == op->game_won)
+		atoms |= MOMENT_ATOM_LEVEL;
+
+	return atoms;
+}
+
+/*
+ * @brief Advances the detector of a match by one point.
+ * Work per point is constant: one predicate check per distinct predicate
+ * and one table lookup per rule.
+ * @param[in] rules The compiled rules
+ * @param[in] stream The detector state of the match
+ * @param[in] winner Which side won the point
+ * @param[in] after The score after the point
+ * @return Bit 'i' is set when rule 'i' fired on this point
+ */
+unsigned int moment_stream_feed(const struct moment_rules *rules, struct moment_stream *stream, key_type winner, const struct match_score *after)
+{
+	unsigned int fired = 0;
+	unsigned int atoms;
+	int i;
+
+	if ((winner == KEY_TYPE_ME && after->my.point_won == POINT_LOVE) ||
+			(winner != KEY_TYPE_ME && after->op.point_won == POINT_LOVE))
+		stream->games_played++;
+
+	atoms = _moment_atoms(winner, after, stream->games_played);
+
+	for (i = 0; i < rules->count; i++) {
+		const struct moment_rule *rule = &rules->rules[i];
+		unsigned int symbol = 0;
+		int p;
+
+		for (p = 0; p < rule->predicate_count; p++) {
+			const struct moment_predicate *pred = &rule->predicates[p];
+			int a;
+
+			for (a = 0; a < pred->count; a++) {
+				if ((atoms & pred->want[a]) == pred->want[a] && !(atoms & pred->forbid[a])) {
+					symbol |= 1u << p;
+					break;
+				}
+			}
+		}
+
+		stream->state[i] = rule->next[stream->state[i] * MOMENT_SYMBOLS(rule->predicate_count) + symbol];
+		if (rule->accept[stream->state[i]])
+			fired |= 1u << i;
+	}
+
+	return fired;
+}
+
+/*
+ * @brief Initializes an empty checkpoint history.
+ */
+void moment_history_init(struct moment_history *history)
+{
+	history->checkpoints = NULL;
+	history->count = 0;
+	history->capacity = 0;
+}
+
+/*
+ * @brief Frees the checkpoints of a match.
+ */
+void moment_history_fini(struct moment_history *history)
+{
+	free(history->checkpoints);
+	moment_history_init(history);
+}
+
+/*
+ * @brief Drops every checkpoint and keeps the memory for the next match.
+ */
+void moment_history_reset(struct moment_history *history)
+{
+	history->count = 0;
+}
+
+/*
+ * @brief Saves the detector state if the match has reached a checkpoint.
+ * A checkpoint that cannot be stored is skipped, resuming then starts
+ * from an earlier one.
+ * @param[in] history The checkpoints of the match
+ * @param[in] stream The detector state after the point
+ * @param[in] points Number of points fed to the detector
+ */
+void moment_history_save(struct moment_history *history, const struct moment_stream *stream, int points)
+{
+	int index;
+
+	if (points == 0 || points % MOMENT_CHECKPOINT_POINTS)
+		return;
+
+	index = points / MOMENT_CHECKPOINT_POINTS - 1;
+	if (index > history->count)
+		return;
+
+	if (index == history->capacity) {
+		int capacity = history->capacity ? history->capacity * 2 : 8;
+		struct moment_stream *checkpoints = realloc(history->checkpoints, capacity * sizeof(*checkpoints));
+
+		if (checkpoints == NULL)
+			return;
+
+		history->checkpoints = checkpoints;
+		history->capacity = capacity;
+	}
+
+	history->checkpoints[index] = *stream;
+	if (index == history->count)
+		history->count++;
+}
+
+/*
+ * @brief Restores the detector state of the last checkpoint at or before a point.
+ * The checkpoints after it are dropped, since the points they were saved
+ * over are about to be fed again.
+ * @param[in] history The checkpoints of the match
+ * @param[in] point Index of the first point that must be fed again
+ * @param[out] stream_out The detector state before the returned point
+ * @return Index of the point to resume feeding from
+ */
+int moment_history_resume(struct moment_history *history, int point, struct moment_stream *stream_out)
+{
+	int count = point / MOMENT_CHECKPOINT_POINTS;
+
+	if (count > history->count)
+		count = history->count;
+	history->count = count;
+
+	if (count == 0)
+		moment_stream_init(stream_out);
+	else
+		*stream_out = history->checkpoints[count - 1];
+
+	return count * MOMENT_CHECKPOINT_POINTS;
+}
@@ -0,0 +1,196 @@
+#include <string.h>
+#include <time.h>
+#include <dlog.h>
+#include <main.h>
+#include "pace.h"
+
+#define PACE_KIND_SHIFT 14
+#define PACE_INTERVAL_MAX ((1 << PACE_KIND_SHIFT) - 1)
+#define PACE_DS_PER_BUCKET 10
+
+/*
+ * The coarse clock is read from the vDSO without a system call, and its
+ * few milliseconds of resolution are far below the decisecond we keep.
+ */
+#if defined(CLOCK_MONOTONIC_COARSE)
+#define PACE_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define PACE_CLOCK CLOCK_MONOTONIC
+#endif
+
+/*
+ * @brief Gets the monotonic time in milliseconds.
+ */
+unsigned long long pace_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(PACE_CLOCK, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * @brief Resets the pace of a match.
+ */
+void pace_series_init(struct pace_series *series)
+{
+	memset(series, 0, sizeof(*series));
+}
+
+/*
+ * @brief Gets the histogram bucket of a point interval.
+ */
+static int _pace_bucket(unsigned int ds)
+{
+	unsigned int bucket = ds / PACE_DS_PER_BUCKET;
+
+	return bucket < PACE_BUCKETS ? (int)bucket : PACE_BUCKETS - 1;
+}
+
+/*
+ * @brief Records the end of a point.
+ * @param[in] series The pace of the match
+ * @param[in] now_ms Time the point ended, from pace_now_ms()
+ * @param[in] next What kind of break follows this point
+ * @return Whether the break and rally that ended with this point were slow
+ */
+pace_event pace_record_point(struct pace_series *series, unsigned long long now_ms, pace_interval next)
+{
+	pace_event event = PACE_EVENT_NONE;
+	pace_interval kind = series->next_kind;
+	unsigned long long ds;
+	unsigned int slot;
+
+	series->next_kind = next;
+
+	/* The first point has no interval before it, nor does a point after one of unknown time */
+	if (series->points++ == 0 || series->untimed) {
+		series->untimed = 0;
+		series->last_ms = now_ms;
+		return PACE_EVENT_NONE;
+	}
+
+	ds = (now_ms - series->last_ms) / 100;
+	if (ds > PACE_INTERVAL_MAX)
+		ds = PACE_INTERVAL_MAX;
+	series->last_ms = now_ms;
+
+	/* Evict the oldest interval once the window is full */
+	if (series->count == PACE_WINDOW) {
+		slot = series->head;
+		if ((series->interval[slot] >> PACE_KIND_SHIFT) == PACE_INTERVAL_POINT) {
+			series->histogram[_pace_bucket(series->interval[slot] & PACE_INTERVAL_MAX)]--;
+			series->point_count--;
+		}
+	} else {
+		slot = (series->head + series->count) % PACE_WINDOW;
+		series->count++;
+	}
+
+	series->interval[slot] = ds | (kind << PACE_KIND_SHIFT);
+	if (series->count == PACE_WINDOW)
+		series->head = (slot + 1) % PACE_WINDOW;
+
+	switch (kind) {
+	case PACE_INTERVAL_POINT:
+		series->histogram[_pace_bucket(ds)]++;
+		series->point_count++;
+		if (ds > PACE_SERVE_CLOCK_DS + PACE_RALLY_ALLOWANCE_DS)
+			event = PACE_EVENT_SLOW_POINT;
+		break;
+	case PACE_INTERVAL_CHANGEOVER:
+	case PACE_INTERVAL_SET_BREAK:
+		series->changeovers++;
+		series->changeover_total += ds;
+		series->last_changeover = ds;
+		if (ds > (kind == PACE_INTERVAL_CHANGEOVER ? PACE_CHANGEOVER_LIMIT_DS : PACE_SET_BREAK_LIMIT_DS) + PACE_RALLY_ALLOWANCE_DS)
+			event = PACE_EVENT_SLOW_CHANGEOVER;
+		break;
+	default:
+		break;
+	}
+
+	if (event != PACE_EVENT_NONE)
+		series->slow_intervals++;
+
+	return event;
+}
+
+/*
+ * @brief Records the end of a point whose time is unknown, e.g. one merged from another device.
+ * The point is counted but neither the interval it ends nor the one after
+ * it is kept, so a merge does not show up as one long break.
+ * @param[in] series The pace of the match
+ * @param[in] next What kind of break follows this point
+ */
+void pace_record_untimed(struct pace_series *series, pace_interval next)
+{
+	series->next_kind = next;
+	series->points++;
+	series->untimed = 1;
+}
+
+/*
+ * @brief Gets the median interval between the ends of points over the window, in seconds.
+ * Changeovers and set breaks are left out. The histogram has a fixed
+ * number of buckets, so this costs the same however long the match is.
+ * @return The median, or -1 if no interval has been recorded
+ */
+int pace_median_point_interval(const struct pace_series *series)
+{
+	int seen = 0;
+	int i;
+
+	if (series->point_count == 0)
+		return -1;
+
+	for (i = 0; i < PACE_BUCKETS; i++) {
+		seen += series->histogram[i];
+		if (seen * 2 >= series->point_count)
+			return i;
+	}
+
+	return PACE_BUCKETS - 1;
+}
+
+/*
+ * @brief Gets the mean interval over the changeovers and set breaks of the match, in deciseconds.
+ * Like every interval it also holds the first rally after the break.
+ * @return The mean, or -1 if there was no changeover yet
+ */
+int pace_mean_changeover(const struct pace_series *series)
+{
+	if (series->changeovers == 0)
+		return -1;
+
+	return series->changeover_total / series->changeovers;
+}
+
+/*
+ * @brief Exports the intervals of the window, oldest first.
+ * Each interval is written as an unsigned LEB128 varint of
+ * (deciseconds << 2 | pace_interval), so most take one or two bytes.
+ * @param[in] series The pace of the match
+ * @param[out] buf Buffer the intervals are written to
+ * @param[in] size Size of the buffer
+ * @return Number of bytes written, or -1 if the buffer is too small
+ */
+int pace_export(const struct pace_series *series, unsigned char *buf, int size)
+{
+	int written = 0;
+	int i;
+
+	for (i = 0; i < series->count; i++) {
+		unsigned short interval = series->interval[(series->head + i) % PACE_WINDOW];
+		unsigned int value = (interval & PACE_INTERVAL_MAX) << 2 | interval >> PACE_KIND_SHIFT;
+
+		do {
+			if (written == size)
+				return -1;
+			buf[written++] = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+			value >>= 7;
+		} while (value);
+	}
+
+	return written;
+}
@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dlog.h>
+#include <main.h>
+#include "data.h"
+#include "point_log.h"
+
+#define POINT_LOG_MIN_CAPACITY 64
+/* Missed or extra taps a merge allows for beyond the difference in length */
+#define POINT_LOG_MERGE_SLACK 16
+/* Alignment costs of two versions that disagree and of a point only one device recorded */
+#define POINT_LOG_COST_DISAGREE 1
+#define POINT_LOG_COST_ALONE 4
+#define POINT_LOG_COST_NONE (INT_MAX / 2)
+
+typedef enum {
+	POINT_LOG_STEP_PAIR = 0,
+	POINT_LOG_STEP_X = 1,
+	POINT_LOG_STEP_Y = 2,
+} point_log_step;
+
+/*
+ * @brief Orders two versions of a point, the first one is kept by a merge.
+ * The order is total, so the versions kept do not depend on which device
+ * merges into which or in what order the logs arrive.
+ */
+static int _point_op_cmp(const point_op *a, const point_op *b)
+{
+	if (a->device_id != b->device_id)
+		return a->device_id < b->device_id ? -1 : 1;
+
+	if (a->clock != b->clock)
+		return a->clock < b->clock ? -1 : 1;
+
+	return (int)a->winner - (int)b->winner;
+}
+
+/*
+ * @brief Grows the log so it can hold at least 'capacity' points.
+ */
+static bool _point_log_reserve(struct point_log *log, int capacity)
+{
+	point_op *ops;
+	struct match_score *states;
+	int new_capacity;
+
+	if (capacity <= log->capacity)
+		return true;
+
+	new_capacity = log->capacity ? log->capacity : POINT_LOG_MIN_CAPACITY;
+	while (new_capacity < capacity)
+		new_capacity *= 2;
+
+	ops = realloc(log->ops, new_capacity * sizeof(*ops));
+	if (ops == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to grow point log");
+		return false;
+	}
+	log->ops = ops;
+
+	states = realloc(log->states, new_capacity * sizeof(*states));
+	if (states == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to grow point log");
+		return false;
+	}
+	log->states = states;
+
+	log->capacity = new_capacity;
+
+	return true;
+}
+
+/*
+ * @brief Recomputes the score of every point from 'first' to the end of the log.
+ * Points before 'first' keep their cached score.
+ */
+static void _point_log_replay(struct point_log *log, int first)
+{
+	struct match_score score = { 0, };
+	int i;
+
+	if (first > 0)
+		score = log->states[first - 1];
+
+	for (i = first; i < log->count; i++) {
+		data_match_score_add_point(&score, log->ops[i].winner);
+		log->states[i] = score;
+	}
+}
+
+/*
+ * @brief Initializes an empty point log.
+ * @param[in] log The log to initialize
+ * @param[in] device_id Id of the device recording the points
+ */
+void point_log_init(struct point_log *log, unsigned int device_id)
+{
+	memset(log, 0, sizeof(*log));
+	log->device_id = device_id;
+}
+
+/*
+ * @brief Releases the memory held by the point log.
+ */
+void point_log_fini(struct point_log *log)
+{
+	free(log->ops);
+	free(log->states);
+	point_log_init(log, log->device_id);
+}
+
+/*
+ * @brief Removes every point from the log, keeping its memory for reuse.
+ */
+void point_log_reset(struct point_log *log)
+{
+	log->count = 0;
+	log->clock = 0;
+}
+
+/*
+ * @brief Records a point won on this device.
+ * @param[in] log The log of the match
+ * @param[in] winner Which side won the point
+ */
+bool point_log_append(struct point_log *log, key_type winner)
+{
+	struct match_score score = { 0, };
+	point_op *op;
+
+	if (!_point_log_reserve(log, log->count + 1))
+		return false;
+
+	if (log->count > 0)
+		score = log->states[log->count - 1];
+
+	data_match_score_add_point(&score, winner);
+
+	/* The clock is ahead of every point seen so far, so no other version has this name */
+	op = &log->ops[log->count];
+	op->clock = ++log->clock;
+	op->device_id = log->device_id;
+	op->winner = winner;
+	log->states[log->count] = score;
+	log->count++;
+
+	return true;
+}
+
+/*
+ * @brief Checks whether two ops are the same version of a point.
+ */
+static bool _point_op_same(const point_op *a, const point_op *b)
+{
+	return a->clock == b->clock && a->device_id == b->device_id;
+}
+
+/*
+ * @brief Gets the cost of taking two ops as versions of the same real point.
+ * @param[out] conflict Set when the ops have the same name and different winners
+ */
+static int _point_op_pair_cost(const point_op *a, const point_op *b, bool *conflict)
+{
+	if (_point_op_same(a, b)) {
+		if (a->winner != b->winner) {
+			*conflict = true;
+			return POINT_LOG_COST_NONE;
+		}
+		return 0;
+	}
+
+	/* A device records a real point once */
+	if (a->device_id == b->device_id)
+		return POINT_LOG_COST_NONE;
+
+	return a->winner == b->winner ? 0 : POINT_LOG_COST_DISAGREE;
+}
+
+/*
+ * @brief Aligns the points two devices recorded since the last point they share.
+ * This is an edit distance over the two runs of points: a step either pairs
+ * two versions of one real point, or keeps a point only one device recorded
+ * because the other one missed it. Only cells within 'band' of the diagonal
+ * are computed, as a missed or extra tap is rare.
+ * @param[in] x The run that orders first, so the result does not depend on
+ *              which device merges into which
+ * @param[in] y The other run
+ * @param[out] out The points kept, in order, room for n + m
+ * @return Number of points kept, -1 if two versions with the same name have
+ *         different winners, -2 if out of memory
+ */
+static int _point_log_align(const point_op *x, int n, const point_op *y, int m, point_op *out)
+{
+	int band = (n > m ? n - m : m - n) + POINT_LOG_MERGE_SLACK;
+	int width = 2 * band + 1;
+	unsigned char *steps = malloc((size_t)(n + 1) * width);
+	int *prev = malloc(width * sizeof(*prev));
+	int *cur = malloc(width * sizeof(*cur));
+	bool conflict = false;
+	int count = 0;
+	int i, j, w;
+
+	if (steps == NULL || prev == NULL || cur == NULL) {
+		count = -2;
+		goto out;
+	}
+
+	/* Cell (i, j) of row i is at j - i + band */
+	for (i = 0; i <= n; i++) {
+		for (w = 0; w < width; w++)
+			cur[w] = POINT_LOG_COST_NONE;
+
+		for (j = i - band > 0 ? i - band : 0; j <= m && j <= i + band; j++) {
+			int cell = j - i + band;
+			int best = POINT_LOG_COST_NONE;
+			unsigned char step = POINT_LOG_STEP_PAIR;
+
+			if (i == 0 && j == 0) {
+				cur[cell] = 0;
+				continue;
+			}
+
+			/* Ties go to the pair, then to the point of x, so the alignment is deterministic */
+			if (i > 0 && j > 0 && prev[cell] < POINT_LOG_COST_NONE) {
+				int cost = _point_op_pair_cost(&x[i - 1], &y[j - 1], &conflict);
+
+				if (cost < POINT_LOG_COST_NONE)
+					best = prev[cell] + cost;
+			}
+			if (i > 0 && cell + 1 < width && prev[cell + 1] + POINT_LOG_COST_ALONE < best) {
+				best = prev[cell + 1] + POINT_LOG_COST_ALONE;
+				step = POINT_LOG_STEP_X;
+			}
+			if (j > 0 && cell > 0 && cur[cell - 1] + POINT_LOG_COST_ALONE < best) {
+				best = cur[cell - 1] + POINT_LOG_COST_ALONE;
+				step = POINT_LOG_STEP_Y;
+			}
+
+			cur[cell] = best;
+			steps[(size_t)i * width + cell] = step;
+		}
+
+		for (w = 0; w < width; w++)
+			prev[w] = cur[w];
+	}
+
+	if (conflict) {
+		count = -1;
+		goto out;
+	}
+
+	/* Walk back from the end, the points come out last first */
+	for (i = n, j = m; i > 0 || j > 0; ) {
+		unsigned char step = steps[(size_t)i * width + j - i + band];
+
+		if (step == POINT_LOG_STEP_PAIR) {
+			out[count++] = _point_op_cmp(&x[i - 1], &y[j - 1]) <= 0 ? x[i - 1] : y[j - 1];
+			i--;
+			j--;
+		} else if (step == POINT_LOG_STEP_X) {
+			out[count++] = x[--i];
+		} else {
+			out[count++] = y[--j];
+		}
+	}
+
+	for (i = 0; i < count / 2; i++) {
+		point_op op = out[i];
+
+		out[i] = out[count - 1 - i];
+		out[count - 1 - i] = op;
+	}
+
+out:
+	free(steps);
+	free(prev);
+	free(cur);
+
+	return count;
+}
+
+/*
+ * @brief Merges the points of another device into the log.
+ * Both logs start with the points they were last synced on, which carry
+ * the same names. The points each device recorded after them are aligned,
+ * so a tap one device missed or recorded twice does not shift the rest of
+ * the match: every distinct point is kept, and of two versions of one real
+ * point the one that orders first. Only the points from the first one
+ * whose winner changed onwards are scored again.
+ * @param[in] log The log to merge into
+ * @param[in] remote The log received from the other device
+ * @return Index of the first point whose score changed, log->count if nothing changed or -1 on failure
+ */
+int point_log_merge(struct point_log *log, const struct point_log *remote)
+{
+	const point_op *x;
+	const point_op *y;
+	point_op *merged;
+	int common = 0;
+	int diverge;
+	int count;
+	int n, m;
+
+	if (remote == NULL || remote->count == 0)
+		return log->count;
+
+	while (common < log->count && common < remote->count && _point_op_same(&log->ops[common], &remote->ops[common])) {
+		if (log->ops[common].winner != remote->ops[common].winner) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Rejected point log: point %d of device %u has two winners", common, log->ops[common].device_id);
+			return -1;
+		}
+		common++;
+	}
+
+	if (common == remote->count)
+		return log->count;
+
+	n = log->count - common;
+	m = remote->count - common;
+	x = log->ops + common;
+	y = remote->ops + common;
+	if (n > 0 && _point_op_cmp(y, x) < 0) {
+		x = remote->ops + common;
+		y = log->ops + common;
+		n = remote->count - common;
+		m = log->count - common;
+	}
+
+	merged = malloc((n + m) * sizeof(*merged));
+	if (merged == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to merge point log");
+		return -1;
+	}
+
+	count = _point_log_align(x, n, y, m, merged);
+	if (count == -1)
+		dlog_print(DLOG_ERROR, LOG_TAG, "Rejected point log: a point after %d has two winners", common);
+	else if (count < 0)
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to merge point log");
+	if (count < 0 || !_point_log_reserve(log, common + count)) {
+		free(merged);
+		return -1;
+	}
+
+	/* The merged points are never fewer than the local ones */
+	for (diverge = common; diverge < log->count && log->ops[diverge].winner == merged[diverge - common].winner; diverge++)
+		;
+
+	memcpy(log->ops + common, merged, count * sizeof(*merged));
+	free(merged);
+
+	log->count = common + count;
+	if (remote->clock > log->clock)
+		log->clock = remote->clock;
+
+	if (diverge == log->count)
+		return log->count;
+
+	_point_log_replay(log, diverge);
+
+	dlog_print(DLOG_INFO, LOG_TAG, "merged point log: %d points, %d shared, replayed from %d", log->count, common, diverge);
+
+	return diverge;
+}
+
+/*
+ * @brief Gets the score after the last point of the log.
+ * @param[in] log The log of the match
+ * @param[out] score_out Score of the match
+ */
+void point_log_get_score(const struct point_log *log, struct match_score *score_out)
+{
+	if (log->count == 0) {
+		memset(score_out, 0, sizeof(*score_out));
+		return;
+	}
+
+	*score_out = log->states[log->count - 1];
+}
+
+/*
+ * @brief Checks whether a point of the log won the match.
+ * The winner of the match has its sets reset, which is the only way back
+ * to no sets, so a point wins the match when it takes its winner from
+ * SET_MATCH - 1 sets to none.
+ * @param[in] log The log of the match
+ * @param[in] i Index of the point
+ */
+bool point_log_wins_match(const struct point_log *log, int i)
+{
+	key_type winner = log->ops[i].winner;
+	int sets_before = 0;
+	int sets_after;
+
+	if (i > 0)
+		sets_before = winner == KEY_TYPE_ME ? log->states[i - 1].my.set_won : log->states[i - 1].op.set_won;
+	sets_after = winner == KEY_TYPE_ME ? log->states[i].my.set_won : log->states[i].op.set_won;
+
+	return sets_before == SET_MATCH - 1 && sets_after == SET_ZERO;
+}
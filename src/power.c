@@ -0,0 +1,109 @@
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <dlog.h>
+#include <main.h>
+#include "power.h"
+
+#define POWER_SEC_PER_HOUR 3600.0
+
+/**
+ * Cost of the application while it is paused, summed over every pause.
+ * Wakeups are the context switches of the process, so they count every
+ * time the paused application was scheduled without hooking the main loop.
+ */
+static struct power_info {
+	double pause_begin;
+	double cpu_begin;
+	long wakeups_begin;
+	bool paused;
+	struct power_stats total;
+} s_info = {
+	.pause_begin = 0.0,
+	.cpu_begin = 0.0,
+	.wakeups_begin = 0,
+	.paused = false,
+	.total = { 0, },
+};
+
+/*
+ * @brief Gets the monotonic time in seconds.
+ */
+static double _power_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * @brief Gets the CPU time and the context switches of the process so far.
+ */
+static void _power_usage(double *cpu_sec_out, long *wakeups_out)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		*cpu_sec_out = 0.0;
+		*wakeups_out = 0;
+		return;
+	}
+
+	*cpu_sec_out = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+			+ usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	*wakeups_out = usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+/*
+ * @brief Starts measuring a pause of the application.
+ */
+void power_pause_begin(void)
+{
+	if (s_info.paused)
+		return;
+
+	s_info.pause_begin = _power_now();
+	_power_usage(&s_info.cpu_begin, &s_info.wakeups_begin);
+	s_info.paused = true;
+}
+
+/*
+ * @brief Stops measuring the pause and logs what it cost.
+ */
+void power_pause_end(void)
+{
+	double paused_sec;
+	double cpu_sec;
+	long wakeups;
+
+	if (!s_info.paused)
+		return;
+
+	paused_sec = _power_now() - s_info.pause_begin;
+	_power_usage(&cpu_sec, &wakeups);
+	cpu_sec -= s_info.cpu_begin;
+	wakeups -= s_info.wakeups_begin;
+	s_info.paused = false;
+
+	s_info.total.paused_sec += paused_sec;
+	s_info.total.cpu_sec += cpu_sec;
+	s_info.total.wakeups += wakeups;
+
+	if (s_info.total.paused_sec <= 0.0)
+		return;
+
+	dlog_print(DLOG_INFO, LOG_TAG, "paused %.1f s: %ld wakeups, %.3f s cpu; per paused hour: %.0f wakeups, %.3f s cpu",
+			paused_sec, wakeups, cpu_sec,
+			s_info.total.wakeups * POWER_SEC_PER_HOUR / s_info.total.paused_sec,
+			s_info.total.cpu_sec * POWER_SEC_PER_HOUR / s_info.total.paused_sec);
+}
+
+/*
+ * @brief Gets the cost of every finished pause so far.
+ * @param[out] stats_out Paused time, CPU time and wakeups summed over the pauses
+ */
+void power_get_stats(struct power_stats *stats_out)
+{
+	*stats_out = s_info.total;
+}
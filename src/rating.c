@@ -0,0 +1,453 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dlog.h>
+#include <main.h>
+#include "rating.h"
+
+#define RATING_INITIAL 1500.0
+#define RATING_INITIAL_RD 350.0
+#define RATING_MIN_RD 30.0
+/* RD growth per idle period, an RD of 50 is back to 350 after about 100 idle periods (8 years) */
+#define RATING_RD_GROWTH 34.6
+#define RATING_Q 0.0057565
+#define RATING_PI_SQUARED 9.8696044
+#define RATING_SEC_PER_DAY 86400
+
+/*
+ * Glicko-1 ratings indexed by the interned id of the player, and the
+ * results they were computed from so that they can be computed again.
+ */
+struct rating_engine {
+	struct rating_player *players;
+	unsigned int capacity;
+	struct rating_result *results;
+	int result_count;
+	int result_capacity;
+	bool weighted;
+};
+
+/*
+ * One side of a result as seen by one player of it.
+ */
+struct rating_entry {
+	unsigned int period;
+	string_id player;
+	string_id opponent;
+	float score;
+	int order;
+};
+
+/*
+ * @brief Gets the rating period of the current day.
+ */
+unsigned int rating_current_period(void)
+{
+	return (unsigned int)(time(NULL) / RATING_SEC_PER_DAY / RATING_PERIOD_DAYS);
+}
+
+/*
+ * @brief Makes sure the engine has a slot for the given player.
+ */
+static bool _rating_engine_reserve(struct rating_engine *engine, string_id player)
+{
+	struct rating_player *players;
+	unsigned int capacity;
+	unsigned int i;
+
+	if (player < engine->capacity)
+		return true;
+
+	capacity = engine->capacity ? engine->capacity : 64;
+	while (capacity <= player)
+		capacity *= 2;
+
+	players = realloc(engine->players, capacity * sizeof(*players));
+	if (players == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to grow rating table");
+		return false;
+	}
+
+	for (i = engine->capacity; i < capacity; i++) {
+		players[i].rating = RATING_INITIAL;
+		players[i].rd = RATING_INITIAL_RD;
+		players[i].last_period = 0;
+		players[i].matches = 0;
+	}
+
+	engine->players = players;
+	engine->capacity = capacity;
+
+	return true;
+}
+
+/*
+ * @brief Gets the RD of a player at the start of a period, grown by the periods it was idle.
+ */
+static double _rating_rd_at(const struct rating_player *player, unsigned int period)
+{
+	double rd;
+
+	if (player->matches == 0)
+		return RATING_INITIAL_RD;
+
+	if (period <= player->last_period)
+		return player->rd;
+
+	rd = sqrt(player->rd * player->rd + RATING_RD_GROWTH * RATING_RD_GROWTH * (period - player->last_period));
+
+	return rd < RATING_INITIAL_RD ? rd : RATING_INITIAL_RD;
+}
+
+/*
+ * @brief Glicko g() function, the weight of a result against an opponent with the given RD.
+ */
+static double _rating_g(double rd)
+{
+	return 1.0 / sqrt(1.0 + 3.0 * RATING_Q * RATING_Q * rd * rd / RATING_PI_SQUARED);
+}
+
+/*
+ * @brief Gets the score of the winner of a result.
+ * Without weighting a win scores 1. With weighting a narrow win scores
+ * closer to 0.5, from the set and game margins of the match.
+ */
+static double _rating_winner_score(const struct rating_engine *engine, const struct rating_result *result)
+{
+	double set_margin = 0.0;
+	double game_margin = 0.0;
+	int games;
+
+	if (!engine->weighted)
+		return 1.0;
+
+	if (result->sets_winner > 0)
+		set_margin = (double)(result->sets_winner - result->sets_loser) / result->sets_winner;
+
+	games = result->games_winner + result->games_loser;
+	if (games > 0)
+		game_margin = (double)(result->games_winner - result->games_loser) / games;
+
+	return 0.5 + 0.25 * (set_margin + (game_margin > 0.0 ? game_margin : 0.0));
+}
+
+/*
+ * @brief Computes the rating of a player after the results of one period.
+ * @param[in] players Ratings before the period
+ * @param[in] entries Results of the player in the period
+ * @param[in] count Number of results
+ * @param[out] player_out Rating after the period
+ */
+static void _rating_update(const struct rating_player *players, const struct rating_entry *entries, int count, struct rating_player *player_out)
+{
+	const struct rating_player *player = &players[entries[0].player];
+	unsigned int period = entries[0].period;
+	double rd = _rating_rd_at(player, period);
+	double d_inv = 0.0;
+	double delta = 0.0;
+	double rd_new;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		const struct rating_player *opponent = &players[entries[i].opponent];
+		double g = _rating_g(_rating_rd_at(opponent, period));
+		double e = 1.0 / (1.0 + pow(10.0, -g * (player->rating - opponent->rating) / 400.0));
+
+		d_inv += g * g * e * (1.0 - e);
+		delta += g * (entries[i].score - e);
+	}
+
+	d_inv *= RATING_Q * RATING_Q;
+	rd_new = 1.0 / sqrt(1.0 / (rd * rd) + d_inv);
+
+	player_out->rating = player->rating + RATING_Q * rd_new * rd_new * delta;
+	player_out->rd = rd_new > RATING_MIN_RD ? rd_new : RATING_MIN_RD;
+	player_out->last_period = period;
+	player_out->matches = player->matches + count;
+}
+
+/*
+ * @brief Creates a rating engine with every player at the initial rating.
+ * @param[in] weighted Whether wins are weighted by their set and game margins
+ */
+struct rating_engine *rating_engine_create(bool weighted)
+{
+	struct rating_engine *engine = calloc(1, sizeof(*engine));
+
+	if (engine == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create rating engine");
+		return NULL;
+	}
+
+	engine->weighted = weighted;
+
+	return engine;
+}
+
+/*
+ * @brief Destroys a rating engine.
+ */
+void rating_engine_destroy(struct rating_engine *engine)
+{
+	if (engine == NULL)
+		return;
+
+	free(engine->players);
+	free(engine->results);
+	free(engine);
+}
+
+/*
+ * @brief Appends results to the history of the engine.
+ */
+static bool _rating_engine_store(struct rating_engine *engine, const struct rating_result *results, int count)
+{
+	struct rating_result *stored;
+	int capacity = engine->result_capacity;
+
+	while (capacity < engine->result_count + count)
+		capacity = capacity ? capacity * 2 : 64;
+
+	if (capacity != engine->result_capacity) {
+		stored = realloc(engine->results, capacity * sizeof(*stored));
+		if (stored == NULL) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Failed to grow rating history");
+			return false;
+		}
+		engine->results = stored;
+		engine->result_capacity = capacity;
+	}
+
+	memcpy(engine->results + engine->result_count, results, count * sizeof(*results));
+	engine->result_count += count;
+
+	return true;
+}
+
+/*
+ * @brief Rates both players of a result from their current ratings.
+ * The result is treated as a rating period of its own.
+ */
+static void _rating_engine_apply(struct rating_engine *engine, const struct rating_result *result)
+{
+	struct rating_entry entry[2];
+	struct rating_player winner;
+	struct rating_player loser;
+	double score = _rating_winner_score(engine, result);
+
+	entry[0].period = result->period;
+	entry[0].player = result->winner;
+	entry[0].opponent = result->loser;
+	entry[0].score = score;
+	entry[1].period = result->period;
+	entry[1].player = result->loser;
+	entry[1].opponent = result->winner;
+	entry[1].score = 1.0 - score;
+
+	/* Both updates read the ratings from before the match */
+	_rating_update(engine->players, &entry[0], 1, &winner);
+	_rating_update(engine->players, &entry[1], 1, &loser);
+	engine->players[result->winner] = winner;
+	engine->players[result->loser] = loser;
+}
+
+/*
+ * @brief Rates both players of a newly finished match right away.
+ * The match is treated as a rating period of its own, and is kept in the
+ * history for the next re-rate.
+ * @param[in] engine The rating engine
+ * @param[in] result The finished match
+ */
+bool rating_engine_add_result(struct rating_engine *engine, const struct rating_result *result)
+{
+	if (!_rating_engine_reserve(engine, result->winner > result->loser ? result->winner : result->loser))
+		return false;
+
+	if (!_rating_engine_store(engine, result, 1))
+		return false;
+
+	_rating_engine_apply(engine, result);
+
+	return true;
+}
+
+/*
+ * @brief Takes back a result, e.g. of a match whose win a merge rewrote.
+ * The latest stored copy of the result is dropped and the rest of the
+ * history is rated again one result at a time, as rating_engine_add_result()
+ * rated it. This costs the whole history, but a result is only taken back
+ * when two devices disagreed on how a match ended.
+ * @param[in] engine The rating engine
+ * @param[in] result The result to take back
+ * @return false if the history holds no such result
+ */
+bool rating_engine_remove_result(struct rating_engine *engine, const struct rating_result *result)
+{
+	unsigned int p;
+	int i;
+
+	for (i = engine->result_count - 1; i >= 0; i--) {
+		const struct rating_result *stored = &engine->results[i];
+
+		if (stored->winner == result->winner && stored->loser == result->loser && stored->period == result->period &&
+				stored->sets_winner == result->sets_winner && stored->sets_loser == result->sets_loser &&
+				stored->games_winner == result->games_winner && stored->games_loser == result->games_loser)
+			break;
+	}
+
+	if (i < 0)
+		return false;
+
+	memmove(&engine->results[i], &engine->results[i + 1], (engine->result_count - i - 1) * sizeof(*engine->results));
+	engine->result_count--;
+
+	for (p = 0; p < engine->capacity; p++) {
+		engine->players[p].rating = RATING_INITIAL;
+		engine->players[p].rd = RATING_INITIAL_RD;
+		engine->players[p].last_period = 0;
+		engine->players[p].matches = 0;
+	}
+
+	for (i = 0; i < engine->result_count; i++)
+		_rating_engine_apply(engine, &engine->results[i]);
+
+	return true;
+}
+
+/*
+ * @brief Orders entries by period, then by player, then by input order.
+ */
+static int _rating_entry_cmp(const void *a, const void *b)
+{
+	const struct rating_entry *x = a;
+	const struct rating_entry *y = b;
+
+	if (x->period != y->period)
+		return x->period < y->period ? -1 : 1;
+	if (x->player != y->player)
+		return x->player < y->player ? -1 : 1;
+
+	return x->order - y->order;
+}
+
+/*
+ * @brief Adds matches finished elsewhere to the history without rating them.
+ * They count from the next re-rate. Players must be named by the ids the
+ * engine already uses, e.g. names interned in the registry of the application.
+ * @param[in] engine The rating engine
+ * @param[in] results Finished matches, in any order
+ * @param[in] count Number of matches
+ */
+bool rating_engine_import(struct rating_engine *engine, const struct rating_result *results, int count)
+{
+	if (count <= 0)
+		return true;
+
+	return _rating_engine_store(engine, results, count);
+}
+
+/*
+ * @brief Rates the whole match history again from scratch.
+ * Results are grouped into rating periods. Unlike rating results one by
+ * one as they are added, every match of a period is rated from the ratings
+ * before the period.
+ * @param[in] engine The rating engine
+ */
+bool rating_engine_rerate(struct rating_engine *engine)
+{
+	const struct rating_result *results = engine->results;
+	int count = engine->result_count;
+	struct rating_entry *entries = NULL;
+	struct rating_player *next = NULL;
+	string_id max_player = 0;
+	int periods = 0;
+	int begin, end;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (results[i].winner > max_player)
+			max_player = results[i].winner;
+		if (results[i].loser > max_player)
+			max_player = results[i].loser;
+	}
+
+	if (!_rating_engine_reserve(engine, max_player))
+		return false;
+
+	for (i = 0; i < (int)engine->capacity; i++) {
+		engine->players[i].rating = RATING_INITIAL;
+		engine->players[i].rd = RATING_INITIAL_RD;
+		engine->players[i].last_period = 0;
+		engine->players[i].matches = 0;
+	}
+
+	if (count == 0)
+		return true;
+
+	entries = malloc(2 * count * sizeof(*entries));
+	next = malloc(engine->capacity * sizeof(*next));
+	if (entries == NULL || next == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to allocate rating batch");
+		free(entries);
+		free(next);
+		return false;
+	}
+
+	for (i = 0; i < count; i++) {
+		double score = _rating_winner_score(engine, &results[i]);
+
+		entries[2 * i].period = results[i].period;
+		entries[2 * i].player = results[i].winner;
+		entries[2 * i].opponent = results[i].loser;
+		entries[2 * i].score = score;
+		entries[2 * i].order = 2 * i;
+		entries[2 * i + 1].period = results[i].period;
+		entries[2 * i + 1].player = results[i].loser;
+		entries[2 * i + 1].opponent = results[i].winner;
+		entries[2 * i + 1].score = 1.0 - score;
+		entries[2 * i + 1].order = 2 * i + 1;
+	}
+
+	qsort(entries, 2 * count, sizeof(*entries), _rating_entry_cmp);
+
+	for (begin = 0; begin < 2 * count; begin = end) {
+		for (end = begin; end < 2 * count && entries[end].period == entries[begin].period; end++)
+			;
+
+		/* Every player of the period is rated from the ratings before it, then they are all published */
+		for (i = begin; i < end; ) {
+			int j = i;
+
+			while (j < end && entries[j].player == entries[i].player)
+				j++;
+			_rating_update(engine->players, &entries[i], j - i, &next[entries[i].player]);
+			i = j;
+		}
+
+		for (i = begin; i < end; i++)
+			engine->players[entries[i].player] = next[entries[i].player];
+		periods++;
+	}
+
+	dlog_print(DLOG_INFO, LOG_TAG, "re-rated %d matches over %d periods", count, periods);
+
+	free(entries);
+	free(next);
+
+	return true;
+}
+
+/*
+ * @brief Gets the rating of a player.
+ * @return false if the player has no rated match
+ */
+bool rating_engine_get(const struct rating_engine *engine, string_id player, struct rating_player *player_out)
+{
+	if (player >= engine->capacity || engine->players[player].matches == 0)
+		return false;
+
+	*player_out = engine->players[player];
+
+	return true;
+}
@@ -0,0 +1,515 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dlog.h>
+#include <main.h>
+#include "data.h"
+#include "point_log.h"
+#include "match_registry.h"
+#include "similarity.h"
+
+#define SIMILARITY_TABLES 8
+/* Hyperplanes per table, the buckets use the first 'bits' of them */
+#define SIMILARITY_BITS 16
+#define SIMILARITY_MIN_BITS 4
+/* Matches per bucket before the tables double */
+#define SIMILARITY_BUCKET_LOAD 16
+#define SIMILARITY_SEED 0x9e3779b9u
+#define SIMILARITY_QUANT 127
+#define SIMILARITY_GAMES_PER_SET 6
+/* Scales of the summary dimensions, about the values of a long match */
+#define SIMILARITY_LEAD_SCALE 6.0f
+#define SIMILARITY_GAMES_SCALE 60.0f
+#define SIMILARITY_POINTS_SCALE 400.0f
+
+/*
+ * Locality-sensitive hash index over fingerprints. Each table hashes a
+ * fingerprint to the signs of its dot products with SIMILARITY_BITS random
+ * hyperplanes, so fingerprints at a small angle share buckets. A table has
+ * 2^bits buckets keyed by the first 'bits' signs, and doubles as the index
+ * grows so that a bucket holds about SIMILARITY_BUCKET_LOAD matches. Buckets
+ * are doubly linked lists threaded through 'next' and 'prev', so adding and
+ * removing a match are O(1). Removed items are reused by the next add.
+ */
+struct similarity_index {
+	float planes[SIMILARITY_TABLES][SIMILARITY_BITS][SIMILARITY_DIMS];
+	/* Item + 1 of the first item in each bucket, 0 for an empty bucket */
+	int *heads;
+	int bits;
+	/* Item + 1 of the neighbours in each table's bucket, 0 at either end */
+	int *next;
+	int *prev;
+	/* Signs of each item in each table, all SIMILARITY_BITS of them */
+	unsigned short *keys;
+	struct similarity_fingerprint *fps;
+	/* MATCH_HANDLE_INVALID for a removed item */
+	match_handle *handles;
+	unsigned int *seen;
+	unsigned int stamp;
+	/* Item + 1 of the first removed item, chained through the next of table 0 */
+	int free_head;
+	int count;
+	int used;
+	int capacity;
+};
+
+/*
+ * @brief Finds the point that won the match.
+ * Points scored after it belong to the next match of the record.
+ * @param[in] log The points of the match
+ * @param[out] won_out Whether the last point counted won the match
+ * @return Number of points up to the one that won the match, every point if none did
+ */
+static int _similarity_match_length(const struct point_log *log, bool *won_out)
+{
+	int i;
+
+	for (i = 0; i < log->count; i++) {
+		if (point_log_wins_match(log, i)) {
+			*won_out = true;
+			return i + 1;
+		}
+	}
+
+	*won_out = false;
+	return log->count;
+}
+
+/*
+ * @brief Builds the fingerprint of a match by replaying its points.
+ * @param[in] log The points of the match
+ * @param[out] fp_out The fingerprint
+ */
+void similarity_fingerprint_compute(const struct point_log *log, struct similarity_fingerprint *fp_out)
+{
+	float v[SIMILARITY_DIMS] = { 0, };
+	int breaks[2] = { 0, 0 };
+	int runs[2] = { 0, 0 };
+	int longest[2] = { 0, 0 };
+	int my_points = 0;
+	int games = 0;
+	int lead_changes = 0;
+	int last_sign = 0;
+	int sample = 0;
+	float norm = 0.0f;
+	bool won;
+	int count = _similarity_match_length(log, &won);
+	int i;
+
+	for (i = 0; i < count; i++) {
+		const struct match_score *score = &log->states[i];
+		key_type winner = log->ops[i].winner;
+		int my_sets = score->my.set_won;
+		int op_sets = score->op.set_won;
+		int lead;
+		int sign;
+
+		/* The score of the winner is reset on the point that won the match */
+		if (won && i == count - 1) {
+			if (winner == KEY_TYPE_ME)
+				my_sets = SET_MATCH;
+			else
+				op_sets = SET_MATCH;
+		}
+
+		lead = (my_sets - op_sets) * SIMILARITY_GAMES_PER_SET + score->my.game_won - score->op.game_won;
+		sign = (lead > 0) - (lead < 0);
+
+		if (winner == KEY_TYPE_ME)
+			my_points++;
+
+		/* Only the side that won a game has its points back to love */
+		if ((winner == KEY_TYPE_ME ? score->my.point_won : score->op.point_won) == POINT_LOVE) {
+			/* Same serving order as the key moment detector: 'me' serves the first game */
+			key_type server = (games & 1) ? KET_TYPE_OPPONENT : KEY_TYPE_ME;
+
+			if (winner != server)
+				breaks[winner]++;
+
+			runs[winner]++;
+			runs[!winner] = 0;
+			if (runs[winner] > longest[winner])
+				longest[winner] = runs[winner];
+
+			if (sign != 0 && last_sign != 0 && sign != last_sign)
+				lead_changes++;
+			if (sign != 0)
+				last_sign = sign;
+
+			games++;
+		}
+
+		/* Sample the lead at evenly spaced points of the match */
+		while (sample < SIMILARITY_TRAJECTORY_SAMPLES && (sample + 1) * count <= (i + 1) * SIMILARITY_TRAJECTORY_SAMPLES) {
+			v[sample] = lead / SIMILARITY_LEAD_SCALE;
+			sample++;
+		}
+	}
+
+	if (games > 0) {
+		v[SIMILARITY_TRAJECTORY_SAMPLES] = (float)breaks[KEY_TYPE_ME] / games;
+		v[SIMILARITY_TRAJECTORY_SAMPLES + 1] = (float)breaks[KET_TYPE_OPPONENT] / games;
+		v[SIMILARITY_TRAJECTORY_SAMPLES + 2] = (float)lead_changes / games;
+		v[SIMILARITY_TRAJECTORY_SAMPLES + 3] = (float)longest[KEY_TYPE_ME] / games;
+		v[SIMILARITY_TRAJECTORY_SAMPLES + 4] = (float)longest[KET_TYPE_OPPONENT] / games;
+	}
+	v[SIMILARITY_TRAJECTORY_SAMPLES + 5] = games / SIMILARITY_GAMES_SCALE;
+	if (count > 0)
+		v[SIMILARITY_TRAJECTORY_SAMPLES + 6] = (float)my_points / count - 0.5f;
+	v[SIMILARITY_TRAJECTORY_SAMPLES + 7] = count / SIMILARITY_POINTS_SCALE;
+
+	for (i = 0; i < SIMILARITY_DIMS; i++)
+		norm += v[i] * v[i];
+	norm = norm > 0.0f ? sqrtf(norm) : 1.0f;
+
+	for (i = 0; i < SIMILARITY_DIMS; i++)
+		fp_out->v[i] = (signed char)lrintf(v[i] / norm * SIMILARITY_QUANT);
+}
+
+/*
+ * @brief Gets the next number of a xorshift generator.
+ */
+static unsigned int _similarity_random(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+/*
+ * @brief Creates an empty index.
+ * The hyperplanes come from a fixed seed, so every index hashes alike.
+ */
+struct similarity_index *similarity_index_create(void)
+{
+	struct similarity_index *index = calloc(1, sizeof(*index));
+	unsigned int state = SIMILARITY_SEED;
+	int t, b, d, n;
+
+	if (index == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create similarity index");
+		return NULL;
+	}
+
+	index->bits = SIMILARITY_MIN_BITS;
+	index->heads = calloc(SIMILARITY_TABLES << index->bits, sizeof(*index->heads));
+	if (index->heads == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create similarity index");
+		free(index);
+		return NULL;
+	}
+
+	/* Sum of uniforms is close enough to Gaussian for random hyperplanes */
+	for (t = 0; t < SIMILARITY_TABLES; t++) {
+		for (b = 0; b < SIMILARITY_BITS; b++) {
+			for (d = 0; d < SIMILARITY_DIMS; d++) {
+				float sum = 0.0f;
+
+				for (n = 0; n < 4; n++)
+					sum += (float)_similarity_random(&state) / 4294967295.0f - 0.5f;
+				index->planes[t][b][d] = sum;
+			}
+		}
+	}
+
+	return index;
+}
+
+/*
+ * @brief Destroys an index.
+ */
+void similarity_index_destroy(struct similarity_index *index)
+{
+	if (index == NULL)
+		return;
+
+	free(index->heads);
+	free(index->next);
+	free(index->prev);
+	free(index->keys);
+	free(index->fps);
+	free(index->handles);
+	free(index->seen);
+	free(index);
+}
+
+/*
+ * @brief Hashes a fingerprint for one table.
+ */
+static unsigned int _similarity_hash(const struct similarity_index *index, int table, const struct similarity_fingerprint *fp)
+{
+	unsigned int key = 0;
+	int b, d;
+
+	for (b = 0; b < SIMILARITY_BITS; b++) {
+		const float *plane = index->planes[table][b];
+		float dot = 0.0f;
+
+		for (d = 0; d < SIMILARITY_DIMS; d++)
+			dot += plane[d] * fp->v[d];
+
+		if (dot >= 0.0f)
+			key |= 1u << b;
+	}
+
+	return key;
+}
+
+/*
+ * @brief Links an item at the head of its bucket in one table.
+ */
+static void _similarity_link(struct similarity_index *index, int item, int table)
+{
+	unsigned int key = index->keys[item * SIMILARITY_TABLES + table] & ((1u << index->bits) - 1);
+	int *head = &index->heads[(table << index->bits) + key];
+
+	index->next[item * SIMILARITY_TABLES + table] = *head;
+	index->prev[item * SIMILARITY_TABLES + table] = 0;
+	if (*head)
+		index->prev[(*head - 1) * SIMILARITY_TABLES + table] = item + 1;
+	*head = item + 1;
+}
+
+/*
+ * @brief Doubles the buckets of every table and moves the matches into them.
+ * The signs of every match are kept, so nothing is hashed again.
+ */
+static bool _similarity_index_split(struct similarity_index *index)
+{
+	int *heads = calloc(SIMILARITY_TABLES << (index->bits + 1), sizeof(*heads));
+	int item, t;
+
+	if (heads == NULL)
+		return false;
+
+	free(index->heads);
+	index->heads = heads;
+	index->bits++;
+
+	for (item = 0; item < index->used; item++) {
+		if (index->handles[item] == MATCH_HANDLE_INVALID)
+			continue;
+		for (t = 0; t < SIMILARITY_TABLES; t++)
+			_similarity_link(index, item, t);
+	}
+
+	return true;
+}
+
+/*
+ * @brief Grows the per-item arrays of the index when no removed item is left to reuse.
+ */
+static bool _similarity_index_reserve(struct similarity_index *index)
+{
+	struct similarity_fingerprint *fps;
+	match_handle *handles;
+	unsigned int *seen;
+	unsigned short *keys;
+	int *next;
+	int *prev;
+	int capacity;
+
+	if (index->free_head || index->used < index->capacity)
+		return true;
+
+	capacity = index->capacity ? index->capacity * 2 : 256;
+
+	next = realloc(index->next, capacity * SIMILARITY_TABLES * sizeof(*next));
+	if (next == NULL)
+		return false;
+	index->next = next;
+
+	prev = realloc(index->prev, capacity * SIMILARITY_TABLES * sizeof(*prev));
+	if (prev == NULL)
+		return false;
+	index->prev = prev;
+
+	keys = realloc(index->keys, capacity * SIMILARITY_TABLES * sizeof(*keys));
+	if (keys == NULL)
+		return false;
+	index->keys = keys;
+
+	fps = realloc(index->fps, capacity * sizeof(*fps));
+	if (fps == NULL)
+		return false;
+	index->fps = fps;
+
+	handles = realloc(index->handles, capacity * sizeof(*handles));
+	if (handles == NULL)
+		return false;
+	index->handles = handles;
+
+	seen = realloc(index->seen, capacity * sizeof(*seen));
+	if (seen == NULL)
+		return false;
+	memset(seen + index->capacity, 0, (capacity - index->capacity) * sizeof(*seen));
+	index->seen = seen;
+
+	index->capacity = capacity;
+
+	return true;
+}
+
+/*
+ * @brief Adds a finished match to the index.
+ * @param[in] index The index
+ * @param[in] handle Handle of the match
+ * @param[in] fp Fingerprint of the match
+ * @return Item of the match for similarity_index_remove(), or -1 on failure
+ */
+int similarity_index_add(struct similarity_index *index, match_handle handle, const struct similarity_fingerprint *fp)
+{
+	int item;
+	int t;
+
+	if (!_similarity_index_reserve(index)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to grow similarity index");
+		return -1;
+	}
+
+	if (index->free_head) {
+		item = index->free_head - 1;
+		index->free_head = index->next[item * SIMILARITY_TABLES];
+	} else {
+		item = index->used++;
+	}
+
+	index->fps[item] = *fp;
+	index->handles[item] = handle;
+	index->seen[item] = 0;
+
+	for (t = 0; t < SIMILARITY_TABLES; t++) {
+		index->keys[item * SIMILARITY_TABLES + t] = _similarity_hash(index, t, fp);
+		_similarity_link(index, item, t);
+	}
+
+	index->count++;
+
+	/* A failed split only leaves the buckets fuller */
+	if (index->bits < SIMILARITY_BITS && index->count > SIMILARITY_BUCKET_LOAD << index->bits &&
+			!_similarity_index_split(index))
+		dlog_print(DLOG_WARN, LOG_TAG, "Failed to split similarity index buckets");
+
+	return item;
+}
+
+/*
+ * @brief Removes a match from the index, e.g. when it is retired.
+ * @param[in] index The index
+ * @param[in] item Item returned when the match was added
+ */
+void similarity_index_remove(struct similarity_index *index, int item)
+{
+	int t;
+
+	if (item < 0 || item >= index->used || index->handles[item] == MATCH_HANDLE_INVALID)
+		return;
+
+	for (t = 0; t < SIMILARITY_TABLES; t++) {
+		int next = index->next[item * SIMILARITY_TABLES + t];
+		int prev = index->prev[item * SIMILARITY_TABLES + t];
+
+		if (prev)
+			index->next[(prev - 1) * SIMILARITY_TABLES + t] = next;
+		else
+			index->heads[(t << index->bits) + (index->keys[item * SIMILARITY_TABLES + t] & ((1u << index->bits) - 1))] = next;
+		if (next)
+			index->prev[(next - 1) * SIMILARITY_TABLES + t] = prev;
+	}
+
+	index->handles[item] = MATCH_HANDLE_INVALID;
+	index->next[item * SIMILARITY_TABLES] = index->free_head;
+	index->free_head = item + 1;
+	index->count--;
+}
+
+/*
+ * @brief Scores the matches of a bucket and keeps the best k.
+ */
+static void _similarity_scan(struct similarity_index *index, int table, unsigned int key, const struct similarity_fingerprint *fp,
+		match_handle exclude, int k, int *found, match_handle *handles_out, float *scores_out)
+{
+	int item = index->heads[(table << index->bits) + key];
+
+	for (; item; item = index->next[(item - 1) * SIMILARITY_TABLES + table]) {
+		const signed char *v = index->fps[item - 1].v;
+		float score;
+		int dot = 0;
+		int d, pos;
+
+		if (index->seen[item - 1] == index->stamp)
+			continue;
+		index->seen[item - 1] = index->stamp;
+
+		if (index->handles[item - 1] == exclude)
+			continue;
+
+		for (d = 0; d < SIMILARITY_DIMS; d++)
+			dot += v[d] * fp->v[d];
+		score = (float)dot / (SIMILARITY_QUANT * SIMILARITY_QUANT);
+
+		if (*found == k && score <= scores_out[k - 1])
+			continue;
+
+		/* Insertion into the sorted top k */
+		pos = *found < k ? (*found)++ : k - 1;
+		while (pos > 0 && scores_out[pos - 1] < score) {
+			scores_out[pos] = scores_out[pos - 1];
+			handles_out[pos] = handles_out[pos - 1];
+			pos--;
+		}
+		scores_out[pos] = score;
+		handles_out[pos] = index->handles[item - 1];
+	}
+}
+
+/*
+ * @brief Finds the matches that unfolded most like the given fingerprint.
+ * Each table is probed at the bucket of the fingerprint and at the buckets
+ * one bit away, and candidates are ranked by cosine similarity. Queries
+ * share scratch state in the index, so they must not run concurrently.
+ * @param[in] index The index
+ * @param[in] fp Fingerprint of the query match
+ * @param[in] exclude Handle left out of the results, MATCH_HANDLE_INVALID for none
+ * @param[in] k Number of matches wanted
+ * @param[out] handles_out Handles of the most similar matches, best first
+ * @param[out] scores_out Cosine similarity of each match
+ * @return Number of matches found, at most k
+ */
+int similarity_index_query(struct similarity_index *index, const struct similarity_fingerprint *fp, match_handle exclude, int k, match_handle *handles_out, float *scores_out)
+{
+	int found = 0;
+	int t, b;
+
+	if (k <= 0)
+		return 0;
+
+	/* A new stamp marks every item as unseen without clearing the array */
+	if (++index->stamp == 0) {
+		memset(index->seen, 0, index->capacity * sizeof(*index->seen));
+		index->stamp = 1;
+	}
+
+	for (t = 0; t < SIMILARITY_TABLES; t++) {
+		unsigned int key = _similarity_hash(index, t, fp) & ((1u << index->bits) - 1);
+
+		_similarity_scan(index, t, key, fp, exclude, k, &found, handles_out, scores_out);
+		for (b = 0; b < index->bits; b++)
+			_similarity_scan(index, t, key ^ (1u << b), fp, exclude, k, &found, handles_out, scores_out);
+	}
+
+	return found;
+}
+
+/*
+ * @brief Gets the number of matches in the index.
+ */
+int similarity_index_count(const struct similarity_index *index)
+{
+	return index->count;
+}
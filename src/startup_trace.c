@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlog.h>
+#include <main.h>
+#include "startup_trace.h"
+
+#define STARTUP_TRACE_STAT_FILE "/proc/self/stat"
+#define STARTUP_TRACE_STAT_MAX 512
+/* Field of /proc/self/stat holding the start time of the process */
+#define STARTUP_TRACE_STARTTIME_FIELD 22
+
+/**
+ * Timestamps of the launch being traced, in milliseconds.
+ */
+static struct startup_trace_info {
+	double begin;
+	double last;
+	bool running;
+} s_info = {
+	.begin = 0.0,
+	.last = 0.0,
+	.running = false,
+};
+
+/*
+ * @brief Reads a clock in milliseconds.
+ */
+static double _startup_trace_now(clockid_t clock_id)
+{
+	struct timespec ts;
+
+	clock_gettime(clock_id, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * @brief Gets how long the process ran before the trace began, in milliseconds.
+ * This covers exec, dynamic linking and the toolkit initialization, which is
+ * where a cold launch differs most from a warm one.
+ * @return The time, or -1 if it is unknown
+ */
+static double _startup_trace_process_age(void)
+{
+	char stat[STARTUP_TRACE_STAT_MAX];
+	unsigned long long start_ticks;
+	long ticks_per_sec;
+	FILE *file;
+	char *p;
+	int field;
+
+	file = fopen(STARTUP_TRACE_STAT_FILE, "r");
+	if (file == NULL)
+		return -1;
+
+	p = fgets(stat, sizeof(stat), file);
+	fclose(file);
+	if (p == NULL)
+		return -1;
+
+	/* The command name may contain spaces, so count fields after its closing parenthesis */
+	p = strrchr(stat, ')');
+	if (p == NULL)
+		return -1;
+
+	for (field = 2; field < STARTUP_TRACE_STARTTIME_FIELD && p; field++)
+		p = strchr(p + 1, ' ');
+
+	ticks_per_sec = sysconf(_SC_CLK_TCK);
+	if (p == NULL || ticks_per_sec <= 0 || sscanf(p, "%llu", &start_ticks) != 1)
+		return -1;
+
+	return _startup_trace_now(CLOCK_BOOTTIME) - start_ticks * 1000.0 / ticks_per_sec;
+}
+
+/*
+ * @brief Starts tracing the launch of the application.
+ */
+void startup_trace_begin(void)
+{
+	s_info.begin = _startup_trace_now(CLOCK_MONOTONIC);
+	s_info.last = s_info.begin;
+	s_info.running = true;
+
+	dlog_print(DLOG_INFO, LOG_TAG, "startup: phase=exec ms=%.2f", _startup_trace_process_age());
+}
+
+/*
+ * @brief Logs how long the phase that just finished took.
+ * @param[in] phase Name of the finished phase
+ */
+void startup_trace_mark(const char *phase)
+{
+	double now;
+
+	if (!s_info.running)
+		return;
+
+	now = _startup_trace_now(CLOCK_MONOTONIC);
+	dlog_print(DLOG_INFO, LOG_TAG, "startup: phase=%s ms=%.2f total=%.2f", phase, now - s_info.last, now - s_info.begin);
+	s_info.last = now;
+}
+
+/*
+ * @brief Logs the last phase and stops tracing.
+ * @param[in] phase Name of the last phase
+ */
+void startup_trace_end(const char *phase)
+{
+	startup_trace_mark(phase);
+	s_info.running = false;
+}
@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <string.h>
+#include <dlog.h>
+#include <main.h>
+#include "string_pool.h"
+
+#define STRING_POOL_CHUNK_SIZE 4096
+#define STRING_POOL_MIN_BUCKETS 64
+/* Strings are stored in slots of 16 to 256 bytes, longer ones get an allocation of their own */
+#define STRING_POOL_MIN_SLOT 16
+#define STRING_POOL_SLOT_CLASSES 5
+
+/*
+ * Slots are carved from large chunks and never move, so the pointers
+ * handed out stay valid until the string is released. Released slots are
+ * kept on a free list per size and reused by the next strings of that size.
+ */
+struct string_chunk {
+	struct string_chunk *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+struct string_pool {
+	struct string_chunk *chunks;
+	char *free_slots[STRING_POOL_SLOT_CLASSES];
+	/* NULL for a released id, whose hash then links the next released id */
+	const char **strings;
+	unsigned int *hashes;
+	unsigned int *refs;
+	int count;
+	int used;
+	int capacity;
+	string_id free_ids;
+	/* Open addressing table of string ids, 0 marks an empty bucket */
+	string_id *buckets;
+	unsigned int bucket_mask;
+};
+
+/*
+ * @brief FNV-1a hash of a string.
+ */
+static unsigned int _string_hash(const char *str, size_t *len_out)
+{
+	unsigned int hash = 2166136261u;
+	const char *p;
+
+	for (p = str; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 16777619u;
+	}
+
+	*len_out = p - str;
+	return hash;
+}
+
+/*
+ * @brief Gets the slot size class of a string, -1 if it is too long for a slot.
+ */
+static int _string_pool_class(size_t len)
+{
+	int class;
+
+	for (class = 0; class < STRING_POOL_SLOT_CLASSES; class++) {
+		if (len + 1 <= (size_t)STRING_POOL_MIN_SLOT << class)
+			return class;
+	}
+
+	return -1;
+}
+
+/*
+ * @brief Copies a string into a free slot of its size, or into a new one.
+ */
+static const char *_string_pool_store(struct string_pool *pool, const char *str, size_t len)
+{
+	struct string_chunk *chunk = pool->chunks;
+	int class = _string_pool_class(len);
+	size_t slot_size;
+	char *copy;
+
+	if (class < 0) {
+		copy = malloc(len + 1);
+		if (copy)
+			memcpy(copy, str, len + 1);
+		return copy;
+	}
+
+	slot_size = (size_t)STRING_POOL_MIN_SLOT << class;
+
+	copy = pool->free_slots[class];
+	if (copy) {
+		/* A free slot holds the next free slot of its size */
+		memcpy(&pool->free_slots[class], copy, sizeof(copy));
+	} else {
+		if (chunk == NULL || chunk->size - chunk->used < slot_size) {
+			chunk = malloc(sizeof(*chunk) + STRING_POOL_CHUNK_SIZE);
+			if (chunk == NULL)
+				return NULL;
+
+			chunk->used = 0;
+			chunk->size = STRING_POOL_CHUNK_SIZE;
+			chunk->next = pool->chunks;
+			pool->chunks = chunk;
+		}
+
+		copy = chunk->data + chunk->used;
+		chunk->used += slot_size;
+	}
+
+	memcpy(copy, str, len + 1);
+
+	return copy;
+}
+
+/*
+ * @brief Gives the storage of a released string back to the pool.
+ */
+static void _string_pool_unstore(struct string_pool *pool, const char *str)
+{
+	int class = _string_pool_class(strlen(str));
+	char *slot = (char *)str;
+
+	if (class < 0) {
+		free(slot);
+		return;
+	}
+
+	memcpy(slot, &pool->free_slots[class], sizeof(slot));
+	pool->free_slots[class] = slot;
+}
+
+/*
+ * @brief Doubles the bucket table and rehashes every string.
+ */
+static bool _string_pool_rehash(struct string_pool *pool)
+{
+	unsigned int size = pool->bucket_mask ? (pool->bucket_mask + 1) * 2 : STRING_POOL_MIN_BUCKETS;
+	string_id *buckets;
+	int i;
+
+	buckets = calloc(size, sizeof(*buckets));
+	if (buckets == NULL)
+		return false;
+
+	for (i = 0; i < pool->used; i++) {
+		unsigned int slot;
+
+		if (pool->strings[i] == NULL)
+			continue;
+
+		slot = pool->hashes[i] & (size - 1);
+
+		while (buckets[slot])
+			slot = (slot + 1) & (size - 1);
+		buckets[slot] = i + 1;
+	}
+
+	free(pool->buckets);
+	pool->buckets = buckets;
+	pool->bucket_mask = size - 1;
+
+	return true;
+}
+
+/*
+ * @brief Grows the id arrays of the pool when no released id is left to reuse.
+ */
+static bool _string_pool_reserve(struct string_pool *pool)
+{
+	const char **strings;
+	unsigned int *hashes;
+	unsigned int *refs;
+	int capacity;
+
+	if (pool->free_ids || pool->used < pool->capacity)
+		return true;
+
+	capacity = pool->capacity ? pool->capacity * 2 : STRING_POOL_MIN_BUCKETS / 2;
+
+	strings = realloc(pool->strings, capacity * sizeof(*strings));
+	if (strings == NULL)
+		return false;
+	pool->strings = strings;
+
+	hashes = realloc(pool->hashes, capacity * sizeof(*hashes));
+	if (hashes == NULL)
+		return false;
+	pool->hashes = hashes;
+
+	refs = realloc(pool->refs, capacity * sizeof(*refs));
+	if (refs == NULL)
+		return false;
+	pool->refs = refs;
+
+	pool->capacity = capacity;
+
+	return true;
+}
+
+/*
+ * @brief Creates an empty string pool.
+ */
+struct string_pool *string_pool_create(void)
+{
+	struct string_pool *pool = calloc(1, sizeof(*pool));
+
+	if (pool == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create string pool");
+		return NULL;
+	}
+
+	if (!_string_pool_rehash(pool)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create string pool");
+		free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/*
+ * @brief Destroys the pool and every string interned in it.
+ */
+void string_pool_destroy(struct string_pool *pool)
+{
+	struct string_chunk *chunk;
+	int i;
+
+	if (pool == NULL)
+		return;
+
+	/* Only the strings too long for a slot live outside the chunks */
+	for (i = 0; i < pool->used; i++) {
+		if (pool->strings[i] && _string_pool_class(strlen(pool->strings[i])) < 0)
+			free((char *)pool->strings[i]);
+	}
+
+	while (pool->chunks) {
+		chunk = pool->chunks;
+		pool->chunks = chunk->next;
+		free(chunk);
+	}
+
+	free(pool->strings);
+	free(pool->hashes);
+	free(pool->refs);
+	free(pool->buckets);
+	free(pool);
+}
+
+/*
+ * @brief Interns a string and takes a reference to it.
+ * @param[in] pool The string pool
+ * @param[in] str The string to intern
+ * @return Id of the string, or 0 on failure
+ */
+string_id string_pool_intern(struct string_pool *pool, const char *str)
+{
+	unsigned int hash;
+	unsigned int slot;
+	const char *copy;
+	string_id id;
+	size_t len;
+
+	if (str == NULL)
+		return 0;
+
+	hash = _string_hash(str, &len);
+
+	for (slot = hash & pool->bucket_mask; pool->buckets[slot]; slot = (slot + 1) & pool->bucket_mask) {
+		string_id id = pool->buckets[slot];
+
+		if (pool->hashes[id - 1] == hash && strcmp(pool->strings[id - 1], str) == 0) {
+			pool->refs[id - 1]++;
+			return id;
+		}
+	}
+
+	if (!_string_pool_reserve(pool)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to intern string");
+		return 0;
+	}
+
+	copy = _string_pool_store(pool, str, len);
+	if (copy == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to intern string");
+		return 0;
+	}
+
+	if (pool->free_ids) {
+		id = pool->free_ids;
+		pool->free_ids = pool->hashes[id - 1];
+	} else {
+		id = ++pool->used;
+	}
+
+	pool->strings[id - 1] = copy;
+	pool->hashes[id - 1] = hash;
+	pool->refs[id - 1] = 1;
+	pool->count++;
+	pool->buckets[slot] = id;
+
+	/* Keep the table at most half full */
+	if ((unsigned int)pool->count * 2 > pool->bucket_mask + 1)
+		_string_pool_rehash(pool);
+
+	return id;
+}
+
+/*
+ * @brief Takes one more reference to an interned string.
+ */
+void string_pool_retain(struct string_pool *pool, string_id id)
+{
+	if (string_pool_get(pool, id))
+		pool->refs[id - 1]++;
+}
+
+/*
+ * @brief Drops a reference to an interned string, the last one frees it.
+ * Its id may then be handed out to another string.
+ */
+void string_pool_release(struct string_pool *pool, string_id id)
+{
+	unsigned int mask = pool->bucket_mask;
+	unsigned int slot;
+	unsigned int next;
+
+	if (string_pool_get(pool, id) == NULL || --pool->refs[id - 1] > 0)
+		return;
+
+	for (slot = pool->hashes[id - 1] & mask; pool->buckets[slot] != id; slot = (slot + 1) & mask)
+		;
+
+	/* Shift the rest of the probe run back so that no lookup stops at the hole */
+	for (next = (slot + 1) & mask; pool->buckets[next]; next = (next + 1) & mask) {
+		unsigned int home = pool->hashes[pool->buckets[next] - 1] & mask;
+
+		if (((next - home) & mask) >= ((next - slot) & mask)) {
+			pool->buckets[slot] = pool->buckets[next];
+			slot = next;
+		}
+	}
+	pool->buckets[slot] = 0;
+
+	_string_pool_unstore(pool, pool->strings[id - 1]);
+	pool->strings[id - 1] = NULL;
+	pool->hashes[id - 1] = pool->free_ids;
+	pool->free_ids = id;
+	pool->count--;
+}
+
+/*
+ * @brief Gets an interned string by its id.
+ * @return The string, or NULL if the id is unknown
+ */
+const char *string_pool_get(const struct string_pool *pool, string_id id)
+{
+	if (id == 0 || id > (string_id)pool->used)
+		return NULL;
+
+	return pool->strings[id - 1];
+}
+
+/*
+ * @brief Gets the number of distinct strings interned in the pool.
+ */
+int string_pool_count(const struct string_pool *pool)
+{
+	return pool->count;
+}
@@ -5,6 +5,10 @@
 #include <dlog.h>
 #include <main.h>
 #include "view.h"
+#include "match_registry.h"
+
+#define MATCH_LIST_TEXT_MAX 128
+#define SCORES_LABEL_COUNT 3
 
 /**
  * Variables regarding with main view.
@@ -15,9 +19,16 @@ static struct view_info {
 	Evas_Object *layout;
 	Evas_Object *my_points_label;
 	Evas_Object *op_points_label;
-	Evas_Object *my_scores_label[3];
-	Evas_Object *op_scores_label[3];
+	Evas_Object *my_scores_label[SCORES_LABEL_COUNT];
+	Evas_Object *op_scores_label[SCORES_LABEL_COUNT];
+	Evas_Object *match_list;
+	Elm_Genlist_Item_Class *match_itc;
+	Elm_Object_Item **match_items;
+	int match_item_count;
+	Elm_Object_Item *new_match_item;
+	Evas_Smart_Cb match_selected_cb;
 	Elm_Theme *theme;
+	Eina_Bool paused;
 } s_info = {
 	.win = NULL,
 	.conform = NULL,
@@ -26,13 +37,23 @@ static struct view_info {
 	.op_points_label = NULL,
 	.my_scores_label = NULL,
 	.op_scores_label = NULL,
+	.match_list = NULL,
+	.match_itc = NULL,
+	.match_items = NULL,
+	.match_item_count = 0,
+	.new_match_item = NULL,
+	.match_selected_cb = NULL,
 	.theme = NULL,
+	.paused = EINA_FALSE,
 };
 
 static void _win_delete_request_cb(void *user_data, Evas_Object *obj, void *event_info);
 static void _layout_back_cb(void *data, Evas_Object *obj, void *event_info);
 static void _button_down_cb(void *data, Evas *e, Evas_Object *obj, void *event_info);
 static void _button_up_cb(void *data, Evas *e, Evas_Object *obj, void *event_info);
+static void _match_list_back_cb(void *data, Evas_Object *obj, void *event_info);
+static char *_match_item_text_get(void *data, Evas_Object *obj, const char *part);
+static void _match_item_del(void *data, Evas_Object *obj);
 
 /**
  * @brief Create Essential Object window, conformant and layout.
@@ -149,11 +170,77 @@ void view_fini_tennis_scores_theme(char *theme)
 	s_info.theme = NULL;
 }
 
+/**
+ * @brief Adds a function called after each frame of the window is rendered.
+ * @param[in] cb The function to be called
+ * @param[in] user_data The user data to be passed to the callback function
+ */
+void view_add_render_post_cb(Evas_Event_Cb cb, void *user_data)
+{
+	if (s_info.win == NULL)
+		return;
+
+	evas_event_callback_add(evas_object_evas_get(s_info.win), EVAS_CALLBACK_RENDER_POST, cb, user_data);
+}
+
+/**
+ * @brief Removes a function added by view_add_render_post_cb().
+ * @param[in] cb The function to be removed
+ */
+void view_del_render_post_cb(Evas_Event_Cb cb)
+{
+	if (s_info.win == NULL)
+		return;
+
+	evas_event_callback_del(evas_object_evas_get(s_info.win), EVAS_CALLBACK_RENDER_POST, cb);
+}
+
+/**
+ * @brief Stops rendering the window and the animations of its layout.
+ * Widgets keep their state, so nothing has to be rebuilt on resume.
+ * The application has no animators or timers of its own to freeze.
+ */
+void view_pause(void)
+{
+	if (s_info.win == NULL || s_info.paused)
+		return;
+
+	elm_win_norender_push(s_info.win);
+	if (s_info.layout)
+		edje_object_play_set(elm_layout_edje_get(s_info.layout), EINA_FALSE);
+
+	s_info.paused = EINA_TRUE;
+}
+
+/**
+ * @brief Renders the window again after view_pause().
+ */
+void view_resume(void)
+{
+	if (s_info.win == NULL || !s_info.paused)
+		return;
+
+	if (s_info.layout)
+		edje_object_play_set(elm_layout_edje_get(s_info.layout), EINA_TRUE);
+	elm_win_norender_pop(s_info.win);
+
+	s_info.paused = EINA_FALSE;
+}
+
 /**
  * @brief Destroys window and free important data to finish this application if necessary.
  */
 void view_destroy(void)
 {
+	if (s_info.match_itc) {
+		elm_genlist_item_class_free(s_info.match_itc);
+		s_info.match_itc = NULL;
+	}
+
+	free(s_info.match_items);
+	s_info.match_items = NULL;
+	s_info.match_item_count = 0;
+
 	if (s_info.win == NULL)
 		return;
 
@@ -326,7 +413,7 @@ void view_create_my_scores_label(void)
 {
 	int i;
 
-	for (i = 0; i <= 3; i++) {
+	for (i = 0; i < SCORES_LABEL_COUNT; i++) {
 		s_info.my_scores_label[i] = elm_label_add(s_info.layout);
 		if (s_info.my_scores_label[i] == NULL) {
 			dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create label");
@@ -344,7 +431,8 @@ void view_create_my_scores_label(void)
 		elm_object_text_set(s_info.my_scores_label[i], styled_text);
 		/* Set label object to the part named "label" in EDJ file */
 		char label_name[1024];
-		snprintf(label_name, sizeof(label_name), "my_scores_label_%d", i);
+		/* Parts in the EDJ file are numbered from 1 */
+		snprintf(label_name, sizeof(label_name), "my_scores_label_%d", i + 1);
 		elm_object_part_content_set(s_info.layout, label_name, s_info.my_scores_label[i]);
 		evas_object_show(s_info.my_scores_label[i]);
 	}
@@ -357,7 +445,7 @@ void view_create_op_scores_label(void)
 {
 	int i;
 
-	for (i = 0; i <= 3; i++) {
+	for (i = 0; i < SCORES_LABEL_COUNT; i++) {
 		s_info.op_scores_label[i] = elm_label_add(s_info.layout);
 		if (s_info.op_scores_label[i] == NULL) {
 			dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create label");
@@ -375,7 +463,8 @@ void view_create_op_scores_label(void)
 		elm_object_text_set(s_info.op_scores_label[i], styled_text);
 		/* Set label object to the part named "label" in EDJ file */
 		char label_name[1024];
-		snprintf(label_name, sizeof(label_name), "op_scores_label_%d", i);
+		/* Parts in the EDJ file are numbered from 1 */
+		snprintf(label_name, sizeof(label_name), "op_scores_label_%d", i + 1);
 		elm_object_part_content_set(s_info.layout, label_name, s_info.op_scores_label[i]);
 		evas_object_show(s_info.op_scores_label[i]);
 	}
@@ -439,7 +528,7 @@ void view_display_my_scores(int points, int game, int set)
 
 	dlog_print(DLOG_INFO, LOG_TAG, "my displayed game: %d", game);
 	snprintf(styled_text, sizeof(styled_text), "<font_size=25><align=right>%d</align></font_size>", game);
-	elm_object_text_set(s_info.my_scores_label[1], styled_text);
+	elm_object_text_set(s_info.my_scores_label[0], styled_text);
 }
 
 
@@ -474,8 +563,186 @@ void view_display_op_scores(int points, int game, int set)
 
 	dlog_print(DLOG_INFO, LOG_TAG, "op displayed game: %d", game);
 	snprintf(styled_text, sizeof(styled_text), "<font_size=25><align=right>%d</align></font_size>", game);
-	elm_object_text_set(s_info.op_scores_label[1], styled_text);
+	elm_object_text_set(s_info.op_scores_label[0], styled_text);
+
+}
+
+/**
+ * @brief Shows an empty score, when there is no match being scored.
+ */
+void view_clear_scores(void)
+{
+	int i;
+
+	elm_object_text_set(s_info.my_points_label, "");
+	elm_object_text_set(s_info.op_points_label, "");
+	for (i = 0; i < SCORES_LABEL_COUNT; i++) {
+		elm_object_text_set(s_info.my_scores_label[i], "");
+		elm_object_text_set(s_info.op_scores_label[i], "");
+	}
+}
+
+/**
+ * @brief Sets the function called when a match is picked from the match list.
+ * The list itself is only built the first time it is shown.
+ * @param[in] selected_cb Function called with a pointer to the handle of the picked match,
+ * MATCH_HANDLE_INVALID when a new match is requested
+ */
+void view_create_match_list(Evas_Smart_Cb selected_cb)
+{
+	s_info.match_selected_cb = selected_cb;
+}
+
+/**
+ * @brief Adds an item for a match to the match list, before the item that starts a new match.
+ * @return The item, NULL on failure
+ */
+static Elm_Object_Item *_match_list_insert(match_handle handle)
+{
+	match_handle *item_data = malloc(sizeof(*item_data));
+	Elm_Object_Item *item;
+
+	if (item_data == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to add match to the list");
+		return NULL;
+	}
+
+	*item_data = handle;
+	if (s_info.new_match_item)
+		item = elm_genlist_item_insert_before(s_info.match_list, s_info.match_itc, item_data, NULL, s_info.new_match_item,
+				ELM_GENLIST_ITEM_NONE, s_info.match_selected_cb, item_data);
+	else
+		item = elm_genlist_item_append(s_info.match_list, s_info.match_itc, item_data, NULL,
+				ELM_GENLIST_ITEM_NONE, s_info.match_selected_cb, item_data);
+
+	if (item == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to add match to the list");
+		free(item_data);
+	}
 
+	return item;
+}
+
+/**
+ * @brief Points the item of a registry slot at the match that lives in it now.
+ * A slot reused by a new match keeps its item, only the handle in it changes.
+ */
+static void _match_list_sync(match_handle handle, struct match *match, void *user_data)
+{
+	unsigned int slot = (unsigned int)handle;
+	match_handle *item_data;
+
+	if (slot >= (unsigned int)s_info.match_item_count)
+		return;
+
+	if (s_info.match_items[slot] == NULL) {
+		s_info.match_items[slot] = _match_list_insert(handle);
+		return;
+	}
+
+	item_data = elm_object_item_data_get(s_info.match_items[slot]);
+	*item_data = handle;
+}
+
+/**
+ * @brief Brings the match list up to date with the registry.
+ * There is one item per registry slot, so only the matches added or retired
+ * since the list was last shown touch the genlist. The realized items are
+ * updated for the scores that changed.
+ */
+static void _match_list_update(struct match_registry *registry)
+{
+	struct match_registry_stats stats;
+	int slot;
+
+	if (s_info.new_match_item == NULL) {
+		/* Last item starts a new match */
+		s_info.new_match_item = _match_list_insert(MATCH_HANDLE_INVALID);
+	}
+
+	if (registry == NULL)
+		return;
+
+	match_registry_get_stats(registry, &stats);
+	if (stats.slots > s_info.match_item_count) {
+		Elm_Object_Item **items = realloc(s_info.match_items, stats.slots * sizeof(*items));
+
+		if (items == NULL) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Failed to grow match list");
+			return;
+		}
+		memset(items + s_info.match_item_count, 0, (stats.slots - s_info.match_item_count) * sizeof(*items));
+		s_info.match_items = items;
+		s_info.match_item_count = stats.slots;
+	}
+
+	match_registry_foreach(registry, _match_list_sync, NULL);
+
+	/* Items of retired matches whose slot is still free */
+	for (slot = 0; slot < s_info.match_item_count; slot++) {
+		match_handle *item_data;
+
+		if (s_info.match_items[slot] == NULL)
+			continue;
+		item_data = elm_object_item_data_get(s_info.match_items[slot]);
+		if (match_registry_get(registry, *item_data) == NULL) {
+			elm_object_item_del(s_info.match_items[slot]);
+			s_info.match_items[slot] = NULL;
+		}
+	}
+
+	elm_genlist_realized_items_update(s_info.match_list);
+}
+
+/**
+ * @brief Shows the list of the matches instead of the score of the current match.
+ * Only the items on screen are realized, the other matches stay as plain
+ * records in the match registry.
+ */
+void view_show_match_list(void)
+{
+	if (s_info.match_list == NULL) {
+		s_info.match_itc = elm_genlist_item_class_new();
+		if (s_info.match_itc == NULL) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create match list item class");
+			return;
+		}
+		s_info.match_itc->item_style = "default";
+		s_info.match_itc->func.text_get = _match_item_text_get;
+		s_info.match_itc->func.del = _match_item_del;
+
+		s_info.match_list = elm_genlist_add(s_info.conform);
+		if (s_info.match_list == NULL) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create match list");
+			return;
+		}
+		/* Every item has the same size, so the list never measures off-screen items */
+		elm_genlist_homogeneous_set(s_info.match_list, EINA_TRUE);
+		elm_genlist_mode_set(s_info.match_list, ELM_LIST_COMPRESS);
+		evas_object_size_hint_weight_set(s_info.match_list, EVAS_HINT_EXPAND, EVAS_HINT_EXPAND);
+		eext_object_event_callback_add(s_info.match_list, EEXT_CALLBACK_BACK, _match_list_back_cb, NULL);
+	}
+
+	_match_list_update(data_get_registry());
+
+	elm_object_content_unset(s_info.conform);
+	evas_object_hide(s_info.layout);
+	elm_object_content_set(s_info.conform, s_info.match_list);
+	evas_object_show(s_info.match_list);
+}
+
+/**
+ * @brief Shows the score of the current match again after the match list.
+ */
+void view_show_match(void)
+{
+	if (s_info.match_list == NULL || elm_object_content_get(s_info.conform) != s_info.match_list)
+		return;
+
+	elm_object_content_unset(s_info.conform);
+	evas_object_hide(s_info.match_list);
+	elm_object_content_set(s_info.conform, s_info.layout);
+	evas_object_show(s_info.layout);
 }
 
 /**
@@ -524,6 +791,65 @@ static void _win_delete_request_cb(void *user_data, Evas_Object *obj, void *even
  * @param[in] event_info The system event information
  */
 static void _layout_back_cb(void *data, Evas_Object *obj, void *event_info)
+{
+	if (s_info.match_selected_cb == NULL) {
+		ui_app_exit();
+		return;
+	}
+
+	view_show_match_list();
+}
+
+/**
+ * @brief Match list back key event callback function.
+ * @param[in] data The data to be passed to the callback function
+ * @param[in] obj The evas object handle to be passed to the callback function
+ * @param[in] event_info The system event information
+ */
+static void _match_list_back_cb(void *data, Evas_Object *obj, void *event_info)
 {
 	ui_app_exit();
 }
+
+/**
+ * @brief Builds the text of a match list item when the item is realized.
+ * @param[in] data Handle of the match shown by the item
+ * @param[in] obj The genlist
+ * @param[in] part Name of the text part
+ */
+static char *_match_item_text_get(void *data, Evas_Object *obj, const char *part)
+{
+	match_handle handle = *(match_handle *) data;
+	struct match_registry *registry = data_get_registry();
+	char text[MATCH_LIST_TEXT_MAX];
+	struct match *match;
+
+	if (strcmp(part, "elm.text"))
+		return NULL;
+
+	if (handle == MATCH_HANDLE_INVALID)
+		return strdup("New match");
+
+	match = registry ? match_registry_get(registry, handle) : NULL;
+	if (match == NULL)
+		return NULL;
+
+	snprintf(text, sizeof(text), "%s%s - %s  %d-%d %d-%d",
+			handle == data_get_active_match() ? "* " : "",
+			match_registry_string(registry, match->my_name),
+			match_registry_string(registry, match->op_name),
+			match->score.my.set_won, match->score.op.set_won,
+			match->score.my.game_won, match->score.op.game_won);
+
+	return strdup(text);
+}
+
+/**
+ * @brief Frees the data of a match list item.
+ * @param[in] data Handle of the match shown by the item
+ * @param[in] obj The genlist
+ */
+static void _match_item_del(void *data, Evas_Object *obj)
+{
+	free(data);
+}